@@ -60,12 +60,40 @@ void tlb_write(uint32_t entryhi, uint32_t entrylo, uint32_t index);
 void tlb_read(uint32_t *entryhi, uint32_t *entrylo, uint32_t index);
 int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
+/*
+ * tlb_setpid: load PID into the address space ID field of ENTRYHI, which
+ *        is what the hardware matches TLB entries against. tlb_random,
+ *        tlb_write, tlb_read and tlb_probe all overwrite ENTRYHI, so it
+ *        has to be set again after using them.
+ */
+void tlb_setpid(uint32_t pid);
+
+/*
+ * Per-cpu state of the fast TLB refill in exception-mips1.S, indexed by
+ * CPU number. TR_PGDIR is the page directory of the address space whose
+ * ID is loaded (NULL sends every miss to vm_fault) and TR_FAST counts the
+ * misses handled there. The assembly code knows this layout.
+ *
+ * tlbrefill_unref has a byte per physical page. The VM system sets it when
+ * its clock clears the page's referenced bit, and the fast refill zeroes
+ * it, since storing zero needs no spare register.
+ */
+struct tlbrefill {
+	uint32_t **tr_pgdir;
+	unsigned tr_fast;
+};
+
+extern struct tlbrefill tlbrefill[];
+extern uint8_t *tlbrefill_unref;
+
 /*
  * TLB entry fields.
  *
- * Note that the MIPS has support for a 6-bit address space ID. In the
- * interests of simplicity, we don't use it. The fields related to it
- * (TLBLO_GLOBAL and TLBHI_PID) can be left always zero, as can the
+ * The MIPS has support for a 6-bit address space ID (TLBHI_PID). An
+ * entry only matches while the same ID is loaded in ENTRYHI, unless
+ * TLBLO_GLOBAL is set; the VM system tags user entries with a per-cpu
+ * ID for the address space so they survive context switches. ID 0 is
+ * never handed out. TLBLO_GLOBAL can be left always zero, as can the
  * bits that aren't assigned a meaning.
  *
  * The TLBLO_DIRTY bit is actually a write privilege bit - it is not
@@ -78,7 +106,8 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 /* Fields in the high-order word */
 #define TLBHI_VPAGE   0xfffff000
-/*      TLBHI_PID     0x00000fc0 */
+#define TLBHI_PID     0x00000fc0
+#define TLBHI_PIDSHIFT 6
 
 /* Fields in the low-order word */
 #define TLBLO_PPAGE   0xfffff000
@@ -101,5 +130,11 @@ int tlb_probe(uint32_t entryhi, uint32_t entrylo);
 
 #define NUM_TLB  64
 
+/*
+ * Number of address space IDs.
+ */
+
+#define NUM_TLBPID 64
+
 
 #endif /* _MIPS_TLB_H_ */
@@ -117,10 +117,8 @@ paddr_t ram_getfirstfree(void);
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	vaddr_t ts_vaddr;		/* page to invalidate */
+	unsigned ts_asid;		/* ...in this address space ID */
 };
 
 #define TLBSHOOTDOWN_MAX 16
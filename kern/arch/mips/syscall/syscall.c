@@ -84,6 +84,7 @@ syscall(struct trapframe *tf)
 	int err;
 	off_t pos;
 	int whence;
+	int fd;
 	KASSERT(curthread != NULL);
 	KASSERT(curthread->t_curspl == 0);
 	KASSERT(curthread->t_iplhigh_count == 0);
@@ -127,6 +128,32 @@ syscall(struct trapframe *tf)
 	    case SYS_getpid:
 	    	err = sys_getpid(&retval);
 	    break;
+	    case SYS_getrusage:
+	    	err = sys_getrusage(tf->tf_a0, (userptr_t)tf->tf_a1, &retval);
+	    break;
+
+	    case SYS_sbrk:
+	    	err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+	    break;
+	    case SYS_mmap:
+	    	/* fd and the 64-bit offset are passed on the stack */
+	    	err = copyin((const_userptr_t)(tf->tf_sp + 16), &fd, sizeof(int));
+	    	if (err == 0) {
+	    		err = copyin((const_userptr_t)(tf->tf_sp + 24), &pos,
+	    			     sizeof(off_t));
+	    	}
+	    	if (err == 0) {
+	    		err = sys_mmap((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+	    			       tf->tf_a3, fd, pos, &retval);
+	    	}
+	    break;
+	    case SYS_munmap:
+	    	err = sys_munmap((userptr_t)tf->tf_a0, tf->tf_a1, &retval);
+	    break;
+	    case SYS_mprotect:
+	    	err = sys_mprotect((userptr_t)tf->tf_a0, tf->tf_a1, tf->tf_a2,
+	    			   &retval);
+	    break;
 
 	    /* End of process system calls */
 
@@ -142,6 +169,43 @@ syscall(struct trapframe *tf)
 		case SYS_read:
 			err = sys_read(tf->tf_a0,(void *) tf->tf_a1,(size_t)tf->tf_a2, &retval);
 		break;
+		case SYS_readv:
+			err = sys_readv(tf->tf_a0, (const struct iovec *)tf->tf_a1,
+					tf->tf_a2, &retval);
+		break;
+		case SYS_writev:
+			err = sys_writev(tf->tf_a0, (const struct iovec *)tf->tf_a1,
+					 tf->tf_a2, &retval);
+		break;
+		case SYS_pread:
+		case SYS_pwrite:
+		case SYS_preadv:
+		case SYS_pwritev:
+			/* the 64-bit offset is aligned past a3, onto the stack */
+			err = copyin((const_userptr_t)(tf->tf_sp + 16), &pos,
+				     sizeof(off_t));
+			if (err) {
+				break;
+			}
+			if (callno == SYS_pread) {
+				err = sys_pread(tf->tf_a0, (void *)tf->tf_a1,
+						(size_t)tf->tf_a2, pos, &retval);
+			}
+			else if (callno == SYS_pwrite) {
+				err = sys_pwrite(tf->tf_a0, (const void *)tf->tf_a1,
+						 (size_t)tf->tf_a2, pos, &retval);
+			}
+			else if (callno == SYS_preadv) {
+				err = sys_preadv(tf->tf_a0,
+						 (const struct iovec *)tf->tf_a1,
+						 tf->tf_a2, pos, &retval);
+			}
+			else {
+				err = sys_pwritev(tf->tf_a0,
+						  (const struct iovec *)tf->tf_a1,
+						  tf->tf_a2, pos, &retval);
+			}
+		break;
 		case SYS_lseek:
 			pos =  (  (off_t)tf->tf_a2 << 32 | tf->tf_a3);
 			if (copyin((const_userptr_t) tf->tf_sp+16, &whence, sizeof(int)) ) {
@@ -157,12 +221,18 @@ syscall(struct trapframe *tf)
 			//char *buf, size_t buflen, int *retval
 			err = sys__getcwd((char *)tf->tf_a0, (size_t) tf->tf_a1, &retval);
 		break;
+		case SYS_pipe:
+			err = sys_pipe((int *)tf->tf_a0, &retval);
+		break;
 		case SYS_dup2:
 			err = sys_dup2(tf->tf_a0, tf->tf_a1, &retval);
 		break;
 		case SYS_chdir:
 			err = sys_chdir((const char *)tf->tf_a0,&retval);
 		break;
+		case SYS_fsync:
+			err = sys_fsync(tf->tf_a0, &retval);
+		break;
 	  default:
 			kprintf("Unknown syscall %d\n", callno);
 			err = ENOSYS;
@@ -35,6 +35,7 @@
 #include <lib.h>
 #include <mips/specialreg.h>
 #include <mips/trapframe.h>
+#include <mips/tlb.h>
 #include <platform/maxcpus.h>
 #include <cpu.h>
 #include <thread.h>
@@ -59,6 +60,14 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Likewise the TLB refill fast path finds the running page table in
+ * tlbrefill[]; see mips/tlb.h. Until the VM system fills these in, every
+ * miss takes the slow path.
+ */
+struct tlbrefill tlbrefill[MAXCPUS];
+uint8_t *tlbrefill_unref;
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
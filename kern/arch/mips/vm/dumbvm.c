@@ -70,6 +70,18 @@ vm_bootstrap(void)
 	/* Do nothing. */
 }
 
+void
+swap_bootstrap(void)
+{
+	/* dumbvm never pages anything out. */
+}
+
+void
+pageout_bootstrap(void)
+{
+	/* Nor does it need a pageout daemon. */
+}
+
 /*
  * Check if we're in a context that can sleep. While most of the
  * operations in dumbvm don't in fact sleep, in a real VM system many
@@ -148,6 +160,13 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+bool
+vm_idle_zero(void)
+{
+	/* dumbvm zeroes nothing ahead of time */
+	return false;
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -304,7 +323,8 @@ as_deactivate(void)
 
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
-		 int readable, int writeable, int executable)
+		 int readable, int writeable, int executable,
+		 struct vnode *v, off_t offset, size_t filesize)
 {
 	size_t npages;
 
@@ -324,6 +344,11 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 	(void)writeable;
 	(void)executable;
 
+	/* Nor these - load_elf reads the segments in eagerly */
+	(void)v;
+	(void)offset;
+	(void)filesize;
+
 	if (as->as_vbase1 == 0) {
 		as->as_vbase1 = vaddr;
 		as->as_npages1 = npages;
@@ -440,3 +465,13 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	*ret = new;
 	return 0;
 }
+
+void
+as_getusage(struct addrspace *as, unsigned *rss, unsigned *maxrss,
+	    unsigned *swapouts)
+{
+	/* Everything is resident from as_prepare_load on, and never swapped */
+	*rss = as->as_npages1 + as->as_npages2 + DUMBVM_STACKPAGES;
+	*maxrss = *rss;
+	*swapouts = 0;
+}
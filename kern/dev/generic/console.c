@@ -39,6 +39,13 @@
  * supported, although such support could be added without undue
  * difficulty.
  *
+ * Otherwise output goes through a ring (cs_outbuf) that the device's
+ * write-done interrupt drains one character at a time, so writers copy
+ * whole chunks in and only sleep when the ring is full. Polled output
+ * empties the ring first, so that nothing queued comes out after it or
+ * gets lost in a panic. Input collects in a second ring (cs_gotchars)
+ * and a read takes everything that has arrived, up to a newline.
+ *
  * Note that nothing happens until we have a device to write to. A
  * buffer of size DELAYBUFSIZE is used to hold output that is
  * generated before this point. This means that (1) using kprintf for
@@ -55,6 +62,7 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <wchan.h>
 #include <generic/console.h>
 #include <vfs.h>
 #include <device.h>
@@ -65,6 +73,11 @@
  */
 static struct con_softc *the_console = NULL;
 
+/*
+ * Most characters a user read or write moves per uiomove.
+ */
+#define CON_CHUNK 256
+
 /*
  * Lock so user I/Os are atomic.
  * We use two locks so readers waiting for input don't lock out writers.
@@ -109,14 +122,92 @@ flush_delay_buf(void)
 
 //////////////////////////////////////////////////
 
+/*
+ * Output ring. Empty when head == tail, full when head+1 == tail. The
+ * caller holds cs_lock.
+ */
+static
+bool
+outbuf_full(struct con_softc *cs)
+{
+	return (cs->cs_outbuf_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE ==
+		cs->cs_outbuf_tail;
+}
+
+/*
+ * Take the next character to send off the ring; -1 if it is empty.
+ */
+static
+int
+outbuf_take(struct con_softc *cs)
+{
+	int ch;
+
+	if (cs->cs_outbuf_head == cs->cs_outbuf_tail) {
+		return -1;
+	}
+	ch = cs->cs_outbuf[cs->cs_outbuf_tail];
+	cs->cs_outbuf_tail =
+		(cs->cs_outbuf_tail + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	return ch;
+}
+
+/*
+ * Start sending the ring if the device is idle.
+ */
+static
+void
+outbuf_kick(struct con_softc *cs)
+{
+	int ch;
+
+	if (cs->cs_sending) {
+		return;
+	}
+	ch = outbuf_take(cs);
+	if (ch >= 0) {
+		cs->cs_sending = true;
+		cs->cs_send(cs->cs_devdata, ch);
+	}
+}
+
+/*
+ * Queue a character, sleeping while the ring is full.
+ */
+static
+void
+outbuf_put(struct con_softc *cs, int ch)
+{
+	while (outbuf_full(cs)) {
+		outbuf_kick(cs);
+		wchan_sleep(cs->cs_wwchan, &cs->cs_lock);
+	}
+	cs->cs_outbuf[cs->cs_outbuf_head] = ch;
+	cs->cs_outbuf_head =
+		(cs->cs_outbuf_head + 1) % CONSOLE_OUTPUT_BUFFER_SIZE;
+}
+
+//////////////////////////////////////////////////
+
 /*
  * Print a character, using polling instead of interrupts to wait for
- * I/O completion.
+ * I/O completion. Whatever is still queued goes first, unless we hold
+ * cs_lock already (a panic in here, say), in which case it has to wait
+ * for the interrupt.
  */
 static
 void
 putch_polled(struct con_softc *cs, int ch)
 {
+	int queued;
+
+	if (!spinlock_do_i_hold(&cs->cs_lock)) {
+		spinlock_acquire(&cs->cs_lock);
+		while ((queued = outbuf_take(cs)) >= 0) {
+			cs->cs_sendpolled(cs->cs_devdata, queued);
+		}
+		spinlock_release(&cs->cs_lock);
+	}
 	cs->cs_sendpolled(cs->cs_devdata, ch);
 }
 
@@ -129,8 +220,61 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
-	cs->cs_send(cs->cs_devdata, ch);
+	spinlock_acquire(&cs->cs_lock);
+	outbuf_put(cs, ch);
+	outbuf_kick(cs);
+	spinlock_release(&cs->cs_lock);
+}
+
+/*
+ * Queue LEN characters of user output, with \n turned into \r\n.
+ */
+static
+void
+con_write(struct con_softc *cs, const char *buf, size_t len)
+{
+	size_t i;
+
+	spinlock_acquire(&cs->cs_lock);
+	for (i = 0; i < len; i++) {
+		if (buf[i] == '\n') {
+			outbuf_put(cs, '\r');
+		}
+		outbuf_put(cs, buf[i]);
+	}
+	outbuf_kick(cs);
+	spinlock_release(&cs->cs_lock);
+}
+
+/*
+ * Wait for input, then take up to MAX characters of what has arrived.
+ * For LINE, \r reads as \n and we stop after a \n.
+ */
+static
+size_t
+con_getchars(struct con_softc *cs, char *buf, size_t max, bool line)
+{
+	size_t n = 0;
+	char ch;
+
+	spinlock_acquire(&cs->cs_lock);
+	while (cs->cs_gotchars_head == cs->cs_gotchars_tail) {
+		wchan_sleep(cs->cs_rwchan, &cs->cs_lock);
+	}
+	while (n < max && cs->cs_gotchars_head != cs->cs_gotchars_tail) {
+		ch = cs->cs_gotchars[cs->cs_gotchars_tail];
+		cs->cs_gotchars_tail =
+			(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
+		if (line && ch == '\r') {
+			ch = '\n';
+		}
+		buf[n++] = ch;
+		if (line && ch == '\n') {
+			break;
+		}
+	}
+	spinlock_release(&cs->cs_lock);
+	return n;
 }
 
 /*
@@ -140,23 +284,17 @@ static
 int
 getch_intr(struct con_softc *cs)
 {
-	unsigned char ret;
+	char ch;
 
-	P(cs->cs_rsem);
-	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
-	cs->cs_gotchars_tail =
-		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
-	return ret;
+	con_getchars(cs, &ch, 1, false);
+	return (unsigned char)ch;
 }
 
 /*
  * Called from underlying device when a read-ready interrupt occurs.
  *
  * Note: if gotchars_head == gotchars_tail, the buffer is empty. Thus
- * if gotchars_head+1 == gotchars_tail, the buffer is full. A slightly
- * tidier way to implement this check (that avoids wasting a slot,
- * too) would be with a second semaphore used with a nonblocking P,
- * but we don't have that in OS/161.
+ * if gotchars_head+1 == gotchars_tail, the buffer is full.
  */
 void
 con_input(void *vcs, int ch)
@@ -164,27 +302,41 @@ con_input(void *vcs, int ch)
 	struct con_softc *cs = vcs;
 	unsigned nexthead;
 
+	spinlock_acquire(&cs->cs_lock);
 	nexthead = (cs->cs_gotchars_head + 1) % CONSOLE_INPUT_BUFFER_SIZE;
 	if (nexthead == cs->cs_gotchars_tail) {
 		/* overflow; drop character */
+		spinlock_release(&cs->cs_lock);
 		return;
 	}
 
 	cs->cs_gotchars[cs->cs_gotchars_head] = ch;
 	cs->cs_gotchars_head = nexthead;
 
-	V(cs->cs_rsem);
+	wchan_wakeall(cs->cs_rwchan, &cs->cs_lock);
+	spinlock_release(&cs->cs_lock);
 }
 
 /*
- * Called from underlying device when a write-done interrupt occurs.
+ * Called from underlying device when a write-done interrupt occurs:
+ * send the next queued character. Writers waiting for room get woken
+ * once the ring is down to half full, not for every character.
  */
 void
 con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
-
-	V(cs->cs_wsem);
+	unsigned used;
+
+	spinlock_acquire(&cs->cs_lock);
+	cs->cs_sending = false;
+	outbuf_kick(cs);
+	used = (cs->cs_outbuf_head + CONSOLE_OUTPUT_BUFFER_SIZE -
+		cs->cs_outbuf_tail) % CONSOLE_OUTPUT_BUFFER_SIZE;
+	if (used <= CONSOLE_OUTPUT_BUFFER_SIZE / 2) {
+		wchan_wakeall(cs->cs_wwchan, &cs->cs_lock);
+	}
+	spinlock_release(&cs->cs_lock);
 }
 
 //////////////////////////////////////////////////
@@ -244,12 +396,12 @@ static
 int
 con_io(struct device *dev, struct uio *uio)
 {
+	struct con_softc *cs = dev->d_data;
+	char buf[CON_CHUNK];
+	size_t len;
 	int result;
-	char ch;
 	struct lock *lk;
 
-	(void)dev;  // unused
-
 	if (uio->uio_rw==UIO_READ) {
 		lk = con_userlock_read;
 	}
@@ -261,30 +413,25 @@ con_io(struct device *dev, struct uio *uio)
 	lock_acquire(lk);
 
 	while (uio->uio_resid > 0) {
+		len = uio->uio_resid < CON_CHUNK ? uio->uio_resid : CON_CHUNK;
 		if (uio->uio_rw==UIO_READ) {
-			ch = getch();
-			if (ch=='\r') {
-				ch = '\n';
-			}
-			result = uiomove(&ch, 1, uio);
+			len = con_getchars(cs, buf, len, true);
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
+			if (buf[len-1]=='\n') {
 				break;
 			}
 		}
 		else {
-			result = uiomove(&ch, 1, uio);
+			result = uiomove(buf, len, uio);
 			if (result) {
 				lock_release(lk);
 				return result;
 			}
-			if (ch=='\n') {
-				putch('\r');
-			}
-			putch(ch);
+			con_write(cs, buf, len);
 		}
 	}
 	lock_release(lk);
@@ -343,7 +490,7 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
+	struct wchan *rwc, *wwc;
 	struct lock *rlk, *wlk;
 
 	/*
@@ -359,33 +506,37 @@ config_con(struct con_softc *cs, int unit)
 	}
 	KASSERT(the_console==NULL);
 
-	rsem = sem_create("console read", 0);
-	if (rsem == NULL) {
+	rwc = wchan_create("console read");
+	if (rwc == NULL) {
 		return ENOMEM;
 	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
+	wwc = wchan_create("console write");
+	if (wwc == NULL) {
+		wchan_destroy(rwc);
 		return ENOMEM;
 	}
 	rlk = lock_create("console-lock-read");
 	if (rlk == NULL) {
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rwc);
+		wchan_destroy(wwc);
 		return ENOMEM;
 	}
 	wlk = lock_create("console-lock-write");
 	if (wlk == NULL) {
 		lock_destroy(rlk);
-		sem_destroy(rsem);
-		sem_destroy(wsem);
+		wchan_destroy(rwc);
+		wchan_destroy(wwc);
 		return ENOMEM;
 	}
 
-	cs->cs_rsem = rsem;
-	cs->cs_wsem = wsem;
+	spinlock_init(&cs->cs_lock);
+	cs->cs_rwchan = rwc;
+	cs->cs_wwchan = wwc;
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
+	cs->cs_outbuf_head = 0;
+	cs->cs_outbuf_tail = 0;
+	cs->cs_sending = false;
 
 	the_console = cs;
 	con_userlock_read = rlk;
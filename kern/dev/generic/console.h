@@ -37,7 +37,22 @@
  * device, and are to be initialized by the attach routine.
  */
 
-#define CONSOLE_INPUT_BUFFER_SIZE 32
+#include <spinlock.h>
+
+/*
+ * Ring sizes. Output is queued in cs_outbuf and fed to the device by its
+ * write-done interrupt, so a writer only waits once the ring is full;
+ * input collects in cs_gotchars until someone reads it. Define these in
+ * the build to trade memory for fewer sleeps.
+ */
+#ifndef CONSOLE_INPUT_BUFFER_SIZE
+#define CONSOLE_INPUT_BUFFER_SIZE 256
+#endif
+#ifndef CONSOLE_OUTPUT_BUFFER_SIZE
+#define CONSOLE_OUTPUT_BUFFER_SIZE 4096
+#endif
+
+struct wchan;
 
 struct con_softc {
 	/* initialized by attach routine */
@@ -46,11 +61,16 @@ struct con_softc {
 	void (*cs_sendpolled)(void *devdata, int ch);
 
 	/* initialized by config routine */
-	struct semaphore *cs_rsem;
-	struct semaphore *cs_wsem;
+	struct spinlock cs_lock;	/* protects everything below */
+	struct wchan *cs_rwchan;	/* readers waiting for input */
+	struct wchan *cs_wwchan;	/* writers waiting for ring space */
 	unsigned char cs_gotchars[CONSOLE_INPUT_BUFFER_SIZE];
 	unsigned cs_gotchars_head;	/* next slot to put a char in */
 	unsigned cs_gotchars_tail;	/* next slot to take a char out */
+	unsigned char cs_outbuf[CONSOLE_OUTPUT_BUFFER_SIZE];
+	unsigned cs_outbuf_head;	/* next slot to put a char in */
+	unsigned cs_outbuf_tail;	/* next slot to send */
+	bool cs_sending;		/* device busy with a char from the ring */
 };
 
 /*
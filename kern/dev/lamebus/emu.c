@@ -844,14 +844,14 @@ emufs_namefile(struct vnode *v, struct uio *uio)
 }
 
 /*
- * VOP_MMAP
+ * VOP_MMAP; mapped pages go through emufs_read and emufs_write.
  */
 static
 int
 emufs_mmap(struct vnode *v)
 {
 	(void)v;
-	return ENOSYS;
+	return 0;
 }
 
 //////////////////////////////
@@ -38,13 +38,70 @@
 #include <vm.h>
 #include "opt-dumbvm.h"
 #include <limits.h>
+#include <platform/maxcpus.h>
 
 struct vnode;
 
-struct page_table_entry {
-    vaddr_t va;
-    paddr_t pa;
-    struct page_table_entry *next, *last;
+/*
+ * Two-level page table. The top 10 bits of a user virtual address index
+ * the page directory, the next 10 bits index one page-sized table of
+ * PTEs, so finding the PTE for a VPN is two array lookups. Second-level
+ * tables are only allocated for parts of the address space in use.
+ *
+ * A PTE holds the physical frame in its PAGE_FRAME bits and flags in the
+ * low bits.
+ */
+typedef uint32_t pte_t;
+
+#define PT_NENTRIES        1024
+#define PT_DIR_INDEX(va)   (((va) >> 22) & 0x3ff)
+#define PT_TABLE_INDEX(va) (((va) >> 12) & 0x3ff)
+#define PT_VADDR(di, ti)   ((vaddr_t)(di) << 22 | (vaddr_t)(ti) << 12)
+
+#define PTE_FRAME          PAGE_FRAME
+#define PTE_VALID          0x001   /* page is resident at PTE_FRAME */
+#define PTE_COW            0x002   /* frame is shared; copy before writing */
+#define PTE_SWAPPED        0x004   /* page is in swap, slot in PTE_FRAME bits */
+
+#define PTE_SWAPSLOT(pte)  ((unsigned)((pte) >> 12))
+#define PTE_MKSWAP(slot)   ((pte_t)(slot) << 12 | PTE_SWAPPED)
+
+/*
+ * TLB address space ID of an address space on one cpu. It is only valid
+ * while gen matches the cpu's c_asid_gen; gen 0 never does.
+ */
+struct as_asid {
+        unsigned asid;
+        unsigned gen;
+};
+
+/*
+ * Part of a region backed by a file: FILESIZE bytes at file
+ * offset OFFSET in VN, to appear at VADDR (which need not be page
+ * aligned). Pages of the region are read in from there when first
+ * touched; anything past the file data is zero-filled.
+ */
+struct as_backing {
+        struct vnode *vn;
+        off_t offset;
+        vaddr_t vaddr;
+        size_t filesize;
+};
+
+/*
+ * A region: NPAGES pages from START with protection PROT (PROT_* from
+ * <kern/mman.h>). ELF segments have FLAGS 0 and MAXPROT equal to PROT.
+ * Mappings made by mmap() have MAP_* flags; MAXPROT is what the file
+ * was opened for, and FILE covers the whole mapping (VN NULL for
+ * anonymous memory). A region holds a reference to FILE.vn.
+ */
+struct as_region {
+        vaddr_t ar_start;
+        size_t ar_npages;
+        int ar_prot;
+        int ar_maxprot;
+        int ar_flags;
+        struct as_backing ar_file;
 };
 
 // struct regionlist {
@@ -72,22 +129,27 @@ struct addrspace {
         paddr_t as_stackpbase;
 #else
         /* Put stuff here for your VM system */
-        /*We are assuming 2 fixed regions, code and data and use the */
-        struct page_table_entry *first;
-        /*Region 1*/
-        vaddr_t as_vbase1;
-        size_t as_npages1;
-        int perm_region1;
-        /*Region 2*/
-        vaddr_t as_vbase2;
-        size_t as_npages2;
-        int perm_region2;
+        pte_t **pgdir;          /* page directory, PT_NENTRIES tables */
+        bool loading;           /* between as_prepare_load and as_complete_load */
+        bool as_noaccess;       /* has had a PROT_NONE region, whose resident
+                                   pages the fast TLB refill would map */
+        /*Regions, sorted by address; see addrspace.c*/
+        struct as_region *as_regions;
+        unsigned as_nregions;
+        unsigned as_maxregions;
         /*stack base + size*/
         vaddr_t as_stackbase;
         size_t nStackPages;
         /*Heap base + size*/
         vaddr_t heapStart;
         vaddr_t heapEnd;
+        /*TLB address space ID on each cpu*/
+        struct as_asid as_asids[MAXCPUS];
+        /*Resident pages (valid PTEs), their peak, and pages written to
+        swap; kept under the coremap lock*/
+        unsigned as_rss;
+        unsigned as_maxrss;
+        unsigned as_swapouts;
 #endif
 };
 
@@ -116,7 +178,8 @@ struct addrspace {
  *                the way this works if implementing user-level threads.
  *
  *    as_define_region - set up a region of memory within the address
- *                space.
+ *                space. If V is not NULL, the first FILESIZE bytes of
+ *                the region come from offset OFFSET in it.
  *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
@@ -128,6 +191,38 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_find_region - check that a faulting address lies in a region, the
+ *                heap or the stack, and whether it may be written.
+ *
+ *    as_load_page - fill the zeroed page at kernel address KVA, which
+ *                backs user page VA, with whatever part of the
+ *                executable belongs there. Sets *LOADED if it read
+ *                anything.
+ *
+ *    as_text_page - check whether page VA is read-only executable text
+ *                that can be shared with other processes running the
+ *                same binary, and find the file offset it starts at.
+ *
+ *    as_shared_page - check whether page VA is in a MAP_SHARED mapping,
+ *                and find the file and offset it comes from (VN NULL
+ *                for anonymous memory).
+ *
+ *    as_map    - create a mapping of NPAGES pages (see struct
+ *                as_region) at an address of its choosing, returned
+ *                in *RET.
+ *
+ *    as_unmap  - remove NPAGES pages of mappings from VA on, writing
+ *                back shared file pages first. Parts of the range
+ *                that are not mapped are ignored.
+ *
+ *    as_protect - change the protection of NPAGES pages from VA on,
+ *                all of which must be mapped.
+ *
+ *    as_heaplimit - the highest address the heap may grow to.
+ *
+ *    as_getusage - report resident pages, the most there have been, and
+ *                pages written out to swap.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -142,12 +237,89 @@ int               as_define_region(struct addrspace *as,
                                    vaddr_t vaddr, size_t sz,
                                    int readable,
                                    int writeable,
-                                   int executable);
+                                   int executable,
+                                   struct vnode *v, off_t offset,
+                                   size_t filesize);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_find_region(struct addrspace *as, vaddr_t va,
+                                 bool *writeable);
+int               as_load_page(struct addrspace *as, vaddr_t va,
+                               vaddr_t kva, bool *loaded);
+bool              as_text_page(struct addrspace *as, vaddr_t va,
+                               struct vnode **vn, off_t *offset);
+bool              as_shared_page(struct addrspace *as, vaddr_t va,
+                                 struct vnode **vn, off_t *offset);
+int               as_map(struct addrspace *as, size_t npages, int prot,
+                         int maxprot, int flags, struct vnode *vn,
+                         off_t offset, vaddr_t *ret);
+int               as_unmap(struct addrspace *as, vaddr_t va, size_t npages);
+int               as_protect(struct addrspace *as, vaddr_t va,
+                             size_t npages, int prot);
+vaddr_t           as_heaplimit(struct addrspace *as);
+void              as_getusage(struct addrspace *as, unsigned *rss,
+                              unsigned *maxrss, unsigned *swapouts);
 
 void deletePageTable(struct addrspace *as);
+
+/*
+ * Functions in pagetable.c:
+ *
+ *    pgdir_create  - allocate an empty page directory. NULL if out of memory.
+ *
+ *    pgdir_lookup  - return a pointer to the PTE for VA. If there is no
+ *                    second-level table for VA yet, one is allocated when
+ *                    CREATE is true and NULL is returned otherwise (or on
+ *                    out-of-memory).
+ *
+ *    pgdir_destroy - free the directory and all second-level tables. The
+ *                    frames the PTEs refer to must already be released.
+ */
+pte_t **pgdir_create(void);
+pte_t  *pgdir_lookup(pte_t **pgdir, vaddr_t va, bool create);
+void    pgdir_destroy(pte_t **pgdir);
+
+/*
+ * Functions in vm.c that deal with the page behind a PTE. PTEs may be
+ * changed by the evictor at any time, so they are only touched with the
+ * coremap lock held:
+ *
+ *    vm_freepte  - drop the frame reference or swap slot behind a PTE of
+ *                  AS and clear it.
+ *
+ *    vm_copypte  - fill in NEWPTE, for page VA of the child NEWAS, from a
+ *                  parent PTE (copy-on-write or eagerly, see as_copy;
+ *                  or the same frame if SHARED).
+ *
+ *    vm_unmap    - release NPAGES pages of AS, the current address space,
+ *                  from VA on and drop them from the TLB.
+ *
+ *    vm_populate - fault in the untouched pages among NPAGES pages of AS,
+ *                  the current address space, from VA on.
+ */
+void    vm_freepte(struct addrspace *as, pte_t *pte);
+int     vm_copypte(struct addrspace *newas, vaddr_t va, pte_t *oldpte,
+                   pte_t *newpte, bool shared);
+void    vm_unmap(struct addrspace *as, vaddr_t va, unsigned npages);
+int     vm_populate(struct addrspace *as, vaddr_t va, unsigned npages);
+
+/*
+ * TLB address space IDs, in vm.c:
+ *
+ *    vm_activate  - load the ID of AS on this cpu into the TLB, handing
+ *                   out a new one if it has none (called by as_activate).
+ *
+ *    vm_asid_flush - forget every TLB entry of AS, which must be the
+ *                   address space of the current process, on all cpus.
+ *
+ *    vm_asid_release - drop the TLB entries of AS before destroying it.
+ *                   VAS lists its resident pages when N, their number, is
+ *                   at most TLBSHOOTDOWN_MAX.
+ */
+void    vm_activate(struct addrspace *as);
+void    vm_asid_flush(struct addrspace *as);
+void    vm_asid_release(struct addrspace *as, const vaddr_t *vas, unsigned n);
 /*
  * Functions in loadelf.c
  *    load_elf - load an ELF user program executable into the current
@@ -73,6 +73,13 @@ void timespec_sub(const struct timespec *t1,
 		  const struct timespec *t2,
 		  struct timespec *ret);
 
+/*
+ * timespec_printrate() prints a time and the rate of COUNT events over
+ * it, e.g. "1.250000000 sec, 800 allocs/sec".
+ */
+void timespec_printrate(const struct timespec *ts, uint64_t count,
+			const char *what);
+
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
@@ -37,6 +37,10 @@
 
 extern unsigned num_cpus;
 
+/* Size of the per-cpu free page magazine, and the refill/drain batch. */
+#define CPU_PAGECACHE_MAX	32
+#define CPU_PAGECACHE_BATCH	(CPU_PAGECACHE_MAX / 2)
+
 /*
  * Per-cpu structure
  *
@@ -63,6 +67,33 @@ struct cpu {
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
 
+	/*
+	 * Accessed only by this cpu, with interrupts off.
+	 *
+	 * Magazine of free single pages kept in front of the global
+	 * coremap lock. It is refilled from and drained to the
+	 * coremap CPU_PAGECACHE_BATCH pages at a time (see vm.c).
+	 */
+	paddr_t c_pagecache[CPU_PAGECACHE_MAX];
+	unsigned c_npagecache;		/* Pages currently in the magazine */
+	unsigned c_pagecache_hits;	/* Allocations served locally */
+	unsigned c_pagecache_misses;	/* Allocations that had to refill */
+	unsigned c_pagecache_frees;	/* Frees absorbed locally */
+	unsigned c_pagecache_drains;	/* Frees that had to drain */
+
+	/*
+	 * Address space IDs for TLB entries (see vm_activate in vm.c).
+	 * Written only by this cpu with interrupts off; other cpus read
+	 * c_asid_gen to decide whether an address space may still have
+	 * entries in this TLB.
+	 */
+	unsigned c_asid_next;		/* Next unused ID in this generation */
+	volatile unsigned c_asid_gen;	/* Bumped whenever the TLB is flushed */
+	unsigned c_asid_cur;		/* ID currently loaded in entryhi */
+	unsigned c_tlb_refills;		/* Translations loaded by vm_fault */
+	unsigned c_tlb_flushes;		/* Whole-TLB flushes */
+	unsigned c_tlb_prefetches;	/* Refills loaded ahead of a miss */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -84,10 +115,15 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * c_shootdown_seq counts the batches of shootdowns handled,
+	 * including flush-everything ones; a request is done once the
+	 * count moves past its value when the request was queued.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_seq;
 	struct spinlock c_ipi_lock;
 };
 
@@ -111,6 +147,11 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Look up a cpu by its software number (0 .. num_cpus-1).
+ */
+struct cpu *cpu_getnum(unsigned software_number);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -154,6 +195,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * It returns a ticket; ipi_tlbshootdown_done(target, ticket) is true
+ * once the target has carried the shootdown out.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -167,7 +210,9 @@ void cpu_halt(void);
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown(struct cpu *target,
+			  const struct tlbshootdown *mapping);
+bool ipi_tlbshootdown_done(struct cpu *target, unsigned ticket);
 
 void interprocessor_interrupt(void);
 
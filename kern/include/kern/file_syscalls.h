@@ -8,25 +8,48 @@
 #include <limits.h>
 #include <uio.h>
 
+struct bitmap;
+
+/** An open file. fork() and dup2() share one between several fd table slots,
+* possibly of different processes, and it goes away with the last of them **/
 struct file_descriptor {
 	char fileName[__NAME_MAX] ; // the file name associated with the FD, can be used for debugging
 	struct vnode* vn; //pointer to underlying file abstraction
 	int openFlags ;   //flag set with which file was opened with
-	int refCount  ;   //keep track of number of references to the file, required in dup2 and fork()
-	struct lock* lk;  //for synchronization between threads sharing the file descriptor
+	int refCount  ;   //fd table slots referring to this file, under lk
+	struct lock* lk;  //for synchronization between processes sharing the file descriptor
 	off_t offset;     //required by lseek syscalls ** TODO : explore any more usage
 };
 
+/** The open files of a process, hung off struct proc. Only the process's own
+* thread uses it, so it has no lock of its own **/
+struct fdtable {
+	struct file_descriptor *ft_files[OPEN_MAX];
+	struct bitmap *ft_used;  //slots of ft_files in use, for finding the lowest free fd
+};
+
 int sys_open(const char *filename, int flags, mode_t mode, int *retval);
 int sys_close(int fHandle,int *retval);
 ssize_t sys_read(int fd, void *buf, size_t nbytes, int *retval);
 ssize_t sys_write(int fd, const void *buf, size_t nbytes, int *retval);
+ssize_t sys_pread(int fd, void *buf, size_t nbytes, off_t offset, int *retval);
+ssize_t sys_pwrite(int fd, const void *buf, size_t nbytes, off_t offset, int *retval);
+ssize_t sys_readv(int fd, const struct iovec *iov, int iovcnt, int *retval);
+ssize_t sys_writev(int fd, const struct iovec *iov, int iovcnt, int *retval);
+ssize_t sys_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset, int *retval);
+ssize_t sys_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset, int *retval);
 off_t sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval2); //off_t is int64, thus two int* to store them
+int sys_pipe(int *filehandles, int *retval);
 int sys_dup2(int oldfd, int newfd, int *retval);
 int sys_chdir(const char *pathname, int *retval);
 int sys__getcwd(char *buf, size_t buflen, int *retval);
+int sys_fsync(int fd, int *retval);
 
 int init_file_descriptor(void);
+void fd_closeall(void);
+int fdtable_copy(struct fdtable *old, struct fdtable **ret);
+void fdtable_destroy(struct fdtable *ft);
+int fd_lookup(int fd, struct file_descriptor **ret);
 void uio_uinit(struct iovec *iov, struct uio *uio, void *kbuff, size_t len, off_t pos, enum uio_rw rw);
 int check_isFileHandleValid(int fHandle);
 
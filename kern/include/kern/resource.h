@@ -36,6 +36,8 @@
  * Not very important.
  */
 
+#include <kern/time.h>	/* for struct timeval */
+
 
 /* priorities for setpriority() */
 #define PRIO_MIN	(-20)
@@ -50,6 +52,12 @@
 #define RUSAGE_SELF	0
 #define RUSAGE_CHILDREN	(-1)
 
+/*
+ * Only memory usage is kept; the times and the other standard counters
+ * are always 0. The fields after ru_nivcsw are OS/161's own. For
+ * RUSAGE_CHILDREN, ru_rss is 0 and ru_maxrss is the largest of any one
+ * child.
+ */
 struct rusage {
 	struct timeval ru_utime;
 	struct timeval ru_stime;
@@ -67,6 +75,10 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+	__size_t ru_rss;		/* RSS now (kb) */
+	__counter_t ru_nswapin;		/* pages read from swap (count) */
+	__counter_t ru_nswapout;	/* pages written to swap (count) */
+	__counter_t ru_ntlbmiss;	/* TLB misses taken to vm_fault (count) */
 };
 
 /* limit codes for getrusage/setrusage */
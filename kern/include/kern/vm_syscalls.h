@@ -0,0 +1,15 @@
+/**
+* The header file declaring the address space system calls
+**/
+#ifndef _VM_CALL_H_
+#define _VM_CALL_H_
+
+#include <types.h>
+
+int sys_sbrk(intptr_t amount, int *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	     off_t offset, int *retval);
+int sys_munmap(userptr_t addr, size_t len, int *retval);
+int sys_mprotect(userptr_t addr, size_t len, int prot, int *retval);
+
+#endif /* _VM_CALL_H_ */
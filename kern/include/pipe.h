@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PIPE_H_
+#define _PIPE_H_
+
+/*
+ * Pipes.
+ *
+ * A pipe is a ring buffer with a vnode at each end. The vnodes have no
+ * name and can only be reached through the file table; closing the
+ * last reference to an end (through vfs_close) shuts that end, and the
+ * pipe goes away once both are shut.
+ */
+
+#include <vm.h>
+
+struct uio;    /* in <uio.h> */
+struct vnode;  /* in <vnode.h> */
+
+/*
+ * Size of the ring. Must be a power of two.
+ */
+#ifndef PIPE_SIZE
+#define PIPE_SIZE PAGE_SIZE
+#endif
+
+/*
+ * Make a pipe; returns its read end and write end, one reference each.
+ */
+int pipe_create(struct vnode **ret_read, struct vnode **ret_write);
+
+/*
+ * Whether VN is one end of a pipe.
+ */
+bool vnode_ispipe(struct vnode *vn);
+
+/*
+ * Read or write a pipe end, according to uio->uio_rw. Unlike VOP_READ
+ * and VOP_WRITE this takes no sleep lock at all, not even the vfs big
+ * lock, when the ring is neither empty nor full.
+ */
+int pipe_io(struct vnode *vn, struct uio *uio);
+
+#endif /* _PIPE_H_ */
@@ -39,10 +39,27 @@
 #include <spinlock.h>
 #include <lib.h>
 #include <synch.h>
+#include <kern/resource.h>
 
 struct addrspace;
 struct thread;
 struct vnode;
+struct fdtable;
+
+/*
+ * Paging counters of a process, bumped by vm_fault as it handles the
+ * process's faults; only the process itself changes them. Its resident
+ * set size and swap-outs are kept in its address space instead, since
+ * other threads evict its pages (see as_rss in addrspace.h).
+ */
+struct proc_vmstats {
+	unsigned pv_minflt;		/* faults served without I/O */
+	unsigned pv_majflt;		/* faults that read a page in */
+	unsigned pv_swapins;		/* ...from swap */
+	unsigned pv_tlbmisses;		/* TLB misses that reached vm_fault */
+	unsigned pv_maxrss;		/* as_maxrss, kept once exited */
+	unsigned pv_swapouts;		/* as_swapouts, kept once exited */
+};
 
 /*
  * Process structure.
@@ -71,6 +88,7 @@ struct proc {
 
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
+	struct fdtable *p_fdtable;	/* open files, or NULL */
 
 	/* add more material here as needed */
 	struct semaphore* exit_sem; 
@@ -78,6 +96,15 @@ struct proc {
 	pid_t ppid;
 	bool has_exited;
 	int exit_code;
+
+	/* Exit; pid_lock in proc.c covers these and ppid */
+	bool p_zombie;			/* exited and out of threads */
+	bool p_orphan;			/* parent gone, the reaper frees it */
+	struct proc *p_reapnext;	/* reaper queue link */
+
+	/* Memory usage */
+	struct proc_vmstats p_vmstats;	/* see above */
+	struct rusage p_childusage;	/* children waited for, see getrusage */
 };
 
 /* This is the process structure for the kernel and for kernel-only threads. */
@@ -89,6 +116,9 @@ void proc_bootstrap(void);
 /* called once during system startup to allocate pid list structures.  */
 void pid_allocation_bootstrap(void);
 
+/* Start the thread that frees orphaned processes once they exit. */
+void proc_reaper_bootstrap(void);
+
 /* Create a fresh process for use by runprogram(). */
 struct proc *proc_create_runprogram(const char *name);
 
@@ -109,4 +139,26 @@ struct addrspace *proc_setas(struct addrspace *);
 
 struct proc* get_pid_proc(pid_t pid);
 
+/* Number of processes, zombies included, other than the kernel's. */
+unsigned proc_count(void);
+
+/*
+ * Exit the current process with wait status STATUS: free its address
+ * space and current directory and hand its children to the reaper. The
+ * caller closes its files and then calls thread_exit().
+ */
+void proc_exit(int status);
+
+/* Wait for CHILD to exit, collect its status and usage, and destroy it. */
+void proc_wait(struct proc *child, int *status);
+
+/* Memory usage of a process, as for getrusage(RUSAGE_SELF). */
+void proc_getusage(struct proc *proc, struct rusage *ru);
+
+/* Add the usage of CHILD, and of its children, to that of PARENT's children. */
+void proc_addchildusage(struct proc *parent, struct proc *child);
+
+/* Print the memory usage of every process, for the ps menu command. */
+void proc_printusage(void);
+
 #endif /* _PROC_H_ */
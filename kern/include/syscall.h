@@ -31,6 +31,8 @@
 #define _SYSCALL_H_
 
 #include <kern/proc_syscalls.h>
+#include <kern/file_syscalls.h>
+#include <kern/vm_syscalls.h>
 #include <cdefs.h> /* for __DEAD */
 struct trapframe; /* from <machine/trapframe.h> */
 
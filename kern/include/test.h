@@ -114,6 +114,9 @@ int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int kmalloctest5(int, char **);
+int coremapbench(int, char **);
+int pidbench(int, char **);
+int zombiesoak(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
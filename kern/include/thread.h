@@ -40,9 +40,6 @@
 #include <spinlock.h>
 #include <threadlist.h>
 
-#include <limits.h>
-#include <kern/file_syscalls.h>
-
 struct cpu;
 
 /* get machine-dependent defs */
@@ -119,7 +116,6 @@ struct thread {
 	 */
 
 	/* add more here as needed */
-	struct file_descriptor* t_fdtable[OPEN_MAX];
 };
 
 /*
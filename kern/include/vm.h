@@ -38,16 +38,48 @@
  #define DIRTY 5
  #define CLEAN 4
 
+/*
+ * The physical page allocator is a binary buddy system over coremap
+ * indices. Free blocks of 2^order pages are kept on per-order free lists
+ * threaded through the coremap entries themselves, so allocation is
+ * O(CM_MAX_ORDER) and a block is found again on free directly from its
+ * physical address.
+ */
+ #define CM_MAX_ORDER 10          /* largest block is 2^10 pages (4M) */
+ #define CM_NONE      (-1)        /* end of a free list / not a block head */
+ #define CM_NOSLOT    0xffffffff  /* user page has no copy in swap */
+ #define CM_RECLAIM_TRIES 4       /* evictions per page before a kernel
+                                     allocation gives up */
+ #define CM_TEXT_BUCKETS 256      /* hash chains of the text cache */
+
+ struct addrspace;
+ struct vnode;
+ struct lock;
 
  paddr_t
  getppages(unsigned long npages);
+ void
+ freeppages(paddr_t paddr);
 
  struct coremap_entry {
    struct addrspace *as;
    vaddr_t va;
-   int allocPageCount;
+   int allocPageCount;  /* pages in the allocation, set on its first page */
 
    char state;
+   char order;          /* order of the free block this entry heads, or CM_NONE */
+   int nextFree;        /* free list links (coremap indices) */
+   int prevFree;
+   int refCount;        /* address spaces mapping this user page (copy-on-write,
+                           shared text or MAP_SHARED) */
+   bool busy;           /* user page being evicted or not yet in its PTE */
+   bool referenced;     /* user page loaded into a TLB since the clock passed */
+   bool dirty;          /* user page differs from its copy in swap */
+   unsigned swapSlot;   /* that copy, or CM_NOSLOT */
+   bool shared;         /* user page of a MAP_SHARED mapping */
+   struct vnode *fileVnode; /* executable or mapped file page in the cache: */
+   off_t fileOffset;    /*   its file and offset, */
+   int nextCached;      /*   and hash chain link (coremap index) */
    paddr_t phyAddr;
  };
 
@@ -61,6 +93,66 @@
 
 
 
+/*
+ * Pages of user stack that may be faulted in below USERSTACK. They are only
+ * backed by memory once touched.
+ */
+#define VM_STACKPAGES        1024
+
+/*
+ * A TLB miss on a resident page also loads the other resident pages of the
+ * aligned block of this many pages around it (a power of two, at most
+ * VM_TLBPREFETCH_MAX; 1 turns it off). The R3000 TLB only maps 4K pages,
+ * so this is how a big array gets covered without trapping on every page.
+ */
+#define VM_TLBPREFETCH       4
+#define VM_TLBPREFETCH_MAX   16
+
+/* Frames idle cpus keep zeroed ahead of zero-fill faults */
+#define VM_ZEROPOOL_PAGES    32
+
+/* Fault statistics */
+struct vm_faultstats {
+	unsigned vfs_faults;		/* faults handled by vm_fault */
+	unsigned vfs_zerofills;		/* pages zero-filled on first touch */
+	unsigned vfs_zeropoolhits;	/* ...with a frame zeroed while idle */
+	unsigned vfs_zeropoolmisses;	/* ...that found the zero pool empty */
+	unsigned vfs_zeropoolfills;	/* frames zeroed by idle cpus */
+	unsigned vfs_filepages;		/* pages read in from executables */
+	unsigned vfs_textshared;	/* ...or found in the text cache */
+	unsigned vfs_cowfaults;		/* writes to copy-on-write pages */
+	unsigned vfs_cowcopies;		/* ...that had to copy the frame */
+	unsigned vfs_dirtyfaults;	/* first writes to clean pages */
+	unsigned vfs_evictions;		/* pages evicted by the clock */
+	unsigned vfs_pageouts;		/* ...that were dirty and written out */
+	unsigned vfs_pageins;		/* pages read back from swap */
+	unsigned vfs_refclears;		/* referenced bits cleared by the clock */
+	unsigned vfs_precleans;		/* dirty pages written back ahead of time */
+	unsigned vfs_shootdowns;	/* TLB shootdown IPIs sent */
+	unsigned vfs_tlbrefills;	/* translations loaded into the TLB */
+	unsigned vfs_tlbprefetches;	/* ...ahead of a miss on them */
+	unsigned vfs_tlbfastrefills;	/* misses refilled without vm_fault */
+	unsigned vfs_tlbflushes;	/* whole-TLB flushes */
+};
+
+/* Share pages copy-on-write in as_copy() (otherwise copy them eagerly) */
+extern bool vm_cow_enabled;
+
+/* Tag TLB entries with address space IDs (otherwise flush on every switch) */
+extern bool vm_asid_enabled;
+
+/* Share read-only executable pages through the text cache */
+extern bool vm_textshare_enabled;
+
+/* Pages per TLB prefetch block, see VM_TLBPREFETCH */
+extern unsigned vm_tlbprefetch;
+
+/* Refill TLB misses on resident pages in exception-mips1.S when possible */
+extern bool vm_fastrefill_enabled;
+
+/* Zero free frames while idle and use them for zero-fill faults */
+extern bool vm_zeropool_enabled;
+
 /* Initialization function */
 void vm_bootstrap(void);
 
@@ -71,6 +163,51 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Swap space, in swap.c. Each slot holds one page. swap_pageout and
+ * swap_pagein must be called with swap_lock held; swap_dup takes it.
+ */
+extern struct lock *swap_lock;
+
+void swap_bootstrap(void);
+bool swap_enabled(void);
+int swap_slot_alloc(unsigned *slot);
+void swap_slot_free(unsigned slot);
+int swap_pageout(paddr_t pa, unsigned slot);
+int swap_pagein(paddr_t pa, unsigned slot);
+int swap_dup(unsigned slot, unsigned *newslot);
+void swap_getstats(unsigned *nslots, unsigned *nused);
+
+/*
+ * Pageout daemon, in pageout.c. It is woken when fewer than
+ * pageout_lowwater frames are free, frees frames until pageout_highwater
+ * are, and then writes back up to pageout_batch dirty pages. The marks
+ * start out as a fraction of RAM and can be changed from the menu.
+ */
+#define PAGEOUT_LOWWATER_FRACTION 32
+#define PAGEOUT_MIN_LOWWATER      8
+
+extern unsigned pageout_lowwater;
+extern unsigned pageout_highwater;
+extern unsigned pageout_batch;
+
+void pageout_bootstrap(void);
+void pageout_kick(void);
+void pageout_printstats(void);
+
+/* Used by the daemon: evict one page to the free lists / clean one page */
+bool vm_pageout_reclaim(void);
+bool vm_pageout_clean(void);
+
+/* Snapshot of the fault counters */
+void vm_getfaultstats(struct vm_faultstats *stats);
+
+/* Zero a frame for the zero pool from the idle loop; false if none needed */
+bool vm_idle_zero(void);
+
+/* Write back dirty MAP_SHARED pages of NPAGES pages of VN from OFFSET */
+int vm_syncfile(struct vnode *vn, off_t offset, unsigned npages);
+
 /*
  * Return amount of memory (in bytes) used by allocated coremap pages.  If
  * there are ongoing allocations, this value could change after it is returned
@@ -78,6 +215,23 @@ void free_kpages(vaddr_t addr);
  */
 unsigned int coremap_used_bytes(void);
 
+/* Free and total page frames under coremap management */
+unsigned coremap_free_pages(void);
+unsigned coremap_total_pages(void);
+
+/* Free frames plus free swap slots */
+unsigned vm_avail_pages(void);
+
+/* Highest coremap_used_bytes() since the last coremap_reset_peak() */
+unsigned coremap_peak_bytes(void);
+void coremap_reset_peak(void);
+
+/* Print page allocator and per-cpu page cache statistics. */
+void coremap_printstats(void);
+
+/* Print per-cpu fast and slow TLB refill counts */
+void vm_printtlbstats(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <lib.h>
 #include <clock.h>
 
 /*
@@ -67,3 +68,22 @@ timespec_sub(const struct timespec *ts1,
 	r.tv_sec -= ts2->tv_sec;
 	*ret = r;
 }
+
+/*
+ * Print "S.NNNNNNNNN sec, R WHAT/sec" and a newline: the time TS and the
+ * rate of COUNT events over it. Benchmarks print their own lead-in first.
+ */
+void
+timespec_printrate(const struct timespec *ts, uint64_t count,
+		   const char *what)
+{
+	uint64_t ns;
+
+	ns = (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+	if (ns == 0) {
+		ns = 1;
+	}
+	kprintf("%llu.%09lu sec, %llu %s/sec\n",
+		(unsigned long long)ts->tv_sec, (unsigned long)ts->tv_nsec,
+		(unsigned long long)(count * 1000000000ULL / ns), what);
+}
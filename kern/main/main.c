@@ -134,6 +134,11 @@ boot(void)
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
 
+	/* Swap on the first disk, if there is one */
+	swap_bootstrap();
+	pageout_bootstrap();
+	proc_reaper_bootstrap();
+
 	kheap_nextgeneration();
 
 	/*
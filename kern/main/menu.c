@@ -42,6 +42,7 @@
 #include <syscall.h>
 #include <test.h>
 #include <prompt.h>
+#include <vm.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-synchprobs.h"
@@ -93,7 +94,8 @@ cmd_progthread(void *ptr, unsigned long nargs)
 	if (result) {
 		kprintf("Running program %s failed: %s\n", args[0],
 			strerror(result));
-		return;
+		/* Exit properly, or the menu waits forever */
+		sys__exit(1);
 	}
 
 	/* NOTREACHED: runprogram only returns on error. */
@@ -178,6 +180,321 @@ cmd_prog(int nargs, char **args)
 	return common_prog(nargs, args);
 }
 
+/*
+ * Command for running a userlevel program and reporting how many page
+ * faults it took and at what rate, e.g. "fb /testbin/matmult" or
+ * "fb /testbin/huge".
+ */
+static
+int
+cmd_faultbench(int nargs, char **args)
+{
+	struct vm_faultstats before, after;
+	struct timespec start, end, diff;
+	unsigned faults, zerofills, filepages, textshared;
+	uint64_t ns;
+	int result;
+
+	if (nargs < 2) {
+		kprintf("Usage: fb program [arguments]\n");
+		return EINVAL;
+	}
+
+	/* drop the leading "fb" */
+	args++;
+	nargs--;
+
+	vm_getfaultstats(&before);
+	gettime(&start);
+	result = common_prog(nargs, args);
+	gettime(&end);
+	vm_getfaultstats(&after);
+	if (result) {
+		return result;
+	}
+
+	timespec_sub(&end, &start, &diff);
+	ns = (uint64_t)diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+	if (ns == 0) {
+		ns = 1;
+	}
+	faults = after.vfs_faults - before.vfs_faults;
+	zerofills = after.vfs_zerofills - before.vfs_zerofills;
+	filepages = after.vfs_filepages - before.vfs_filepages;
+	textshared = after.vfs_textshared - before.vfs_textshared;
+	kprintf("%s: %u faults (%u zero-filled, %u read from executables, "
+		"%u shared) in %llu.%09lu sec, %llu faults/sec\n", args[0],
+		faults, zerofills, filepages, textshared,
+		(unsigned long long)diff.tv_sec, (unsigned long)diff.tv_nsec,
+		(unsigned long long)faults * 1000000000ULL / ns);
+	kprintf("%s: %u zero-fill frames from the zero pool, %u zeroed "
+		"on the spot\n", args[0],
+		after.vfs_zeropoolhits - before.vfs_zeropoolhits,
+		after.vfs_zeropoolmisses - before.vfs_zeropoolmisses);
+	kprintf("%s: %u copy-on-write faults, %u pages copied\n", args[0],
+		after.vfs_cowfaults - before.vfs_cowfaults,
+		after.vfs_cowcopies - before.vfs_cowcopies);
+	kprintf("%s: %u pages swapped out, %u swapped in\n", args[0],
+		after.vfs_pageouts - before.vfs_pageouts,
+		after.vfs_pageins - before.vfs_pageins);
+	kprintf("%s: %u fast TLB refills, %u TLB refills (%u prefetched), "
+		"%u TLB flushes, %u shootdown IPIs\n", args[0],
+		after.vfs_tlbfastrefills - before.vfs_tlbfastrefills,
+		after.vfs_tlbrefills - before.vfs_tlbrefills,
+		after.vfs_tlbprefetches - before.vfs_tlbprefetches,
+		after.vfs_tlbflushes - before.vfs_tlbflushes,
+		after.vfs_shootdowns - before.vfs_shootdowns);
+	return 0;
+}
+
+/*
+ * Command for choosing between copy-on-write and eager copying in fork,
+ * for comparing the two with /testbin/forkexec.
+ */
+static
+int
+cmd_cow(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		vm_cow_enabled = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		vm_cow_enabled = false;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: cow [on|off]\n");
+		return EINVAL;
+	}
+	kprintf("fork copies address spaces %s\n",
+		vm_cow_enabled ? "copy-on-write" : "eagerly");
+	return 0;
+}
+
+/*
+ * Command for choosing whether processes running the same binary share
+ * its read-only pages, for comparing the two with "mi".
+ */
+static
+int
+cmd_share(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		vm_textshare_enabled = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		vm_textshare_enabled = false;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: share [on|off]\n");
+		return EINVAL;
+	}
+	kprintf("read-only executable pages are %s\n",
+		vm_textshare_enabled ? "shared" : "private");
+	return 0;
+}
+
+#define MI_MAX 16
+
+/*
+ * Command for running several copies of a program at once and reporting
+ * the most memory in use while they ran, e.g. "mi 8 /testbin/sort".
+ */
+static
+int
+cmd_multiinstance(int nargs, char **args)
+{
+	struct vm_faultstats before, after;
+	struct proc *proc;
+	pid_t pids[MI_MAX];
+	unsigned base, peak, tc;
+	int i, n, result, status, retval;
+
+	if (nargs < 3 || (n = atoi(args[1])) < 1 || n > MI_MAX) {
+		kprintf("Usage: mi count program (count at most %d)\n",
+			MI_MAX);
+		return EINVAL;
+	}
+
+	/* drop the leading "mi count" */
+	args += 2;
+	nargs -= 2;
+
+	tc = thread_count;
+	vm_getfaultstats(&before);
+	coremap_reset_peak();
+	base = coremap_used_bytes();
+
+	for (i = 0; i < n; i++) {
+		proc = proc_create_runprogram(args[0]);
+		if (proc == NULL) {
+			result = ENOMEM;
+			break;
+		}
+		result = thread_fork(args[0], proc, cmd_progthread,
+				     args, nargs);
+		if (result) {
+			kprintf("thread_fork failed: %s\n", strerror(result));
+			proc_destroy(proc);
+			break;
+		}
+		pids[i] = proc->pid;
+	}
+	n = i;
+
+	for (i = 0; i < n; i++) {
+		sys_waitpid(pids[i], &status, 0, &retval);
+	}
+	thread_wait_for_count(tc);
+
+	peak = coremap_peak_bytes();
+	vm_getfaultstats(&after);
+	kprintf("%s x%d: peak %u KB in use, %u KB over the %u KB before\n",
+		args[0], n, peak / 1024, (peak - base) / 1024, base / 1024);
+	kprintf("%s x%d: %u pages read from the executable, "
+		"%u shared from the text cache\n", args[0], n,
+		after.vfs_filepages - before.vfs_filepages,
+		after.vfs_textshared - before.vfs_textshared);
+	return result;
+}
+
+/*
+ * Command for choosing between address-space-tagged TLB entries and
+ * flushing the TLB on every context switch, for comparing the two with
+ * e.g. /testbin/schedpong.
+ */
+static
+int
+cmd_tlb(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		vm_asid_enabled = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		vm_asid_enabled = false;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: tlb [on|off]\n");
+		return EINVAL;
+	}
+	kprintf("context switches %s the TLB\n",
+		vm_asid_enabled ? "keep" : "flush");
+	return 0;
+}
+
+/*
+ * Command for choosing whether TLB misses on resident pages are refilled
+ * straight from the page table in the exception handler or all go through
+ * vm_fault. Takes effect at the next context switch.
+ */
+static
+int
+cmd_refill(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "fast")) {
+		vm_fastrefill_enabled = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "slow")) {
+		vm_fastrefill_enabled = false;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: refill [fast|slow]\n");
+		return EINVAL;
+	}
+	kprintf("TLB misses on resident pages are refilled %s\n",
+		vm_fastrefill_enabled ? "in the exception handler" :
+		"by vm_fault");
+	return 0;
+}
+
+/*
+ * Command for choosing whether idle cpus zero frames ahead of zero-fill
+ * faults, for comparing e.g. "fb /testbin/zero" with and without.
+ */
+static
+int
+cmd_zeropool(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "on")) {
+		vm_zeropool_enabled = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		vm_zeropool_enabled = false;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: zp [on|off]\n");
+		return EINVAL;
+	}
+	kprintf("zero-fill faults %s\n", vm_zeropool_enabled ?
+		"use frames zeroed while idle" : "zero their frames");
+	return 0;
+}
+
+/*
+ * Command for setting how many pages around a TLB miss get loaded with it,
+ * for comparing e.g. "fb /testbin/matmult" with and without prefetching.
+ */
+static
+int
+cmd_tlbprefetch(int nargs, char **args)
+{
+	unsigned n;
+
+	if (nargs == 2) {
+		n = atoi(args[1]);
+		if (n < 1 || n > VM_TLBPREFETCH_MAX || (n & (n - 1)) != 0) {
+			kprintf("Usage: tlbpf [pages] (a power of two, "
+				"at most %d)\n", VM_TLBPREFETCH_MAX);
+			return EINVAL;
+		}
+		vm_tlbprefetch = n;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: tlbpf [pages]\n");
+		return EINVAL;
+	}
+	if (vm_tlbprefetch == 1) {
+		kprintf("TLB prefetching is off\n");
+	}
+	else {
+		kprintf("TLB misses load aligned blocks of %u pages\n",
+			vm_tlbprefetch);
+	}
+	return 0;
+}
+
+/*
+ * Command for showing the pageout daemon's statistics and setting its
+ * free-memory marks and write-back batch size.
+ */
+static
+int
+cmd_pageout(int nargs, char **args)
+{
+	unsigned low, high, batch;
+
+	if (nargs != 1 && nargs != 3 && nargs != 4) {
+		kprintf("Usage: pod [lowwater highwater [batch]]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		low = atoi(args[1]);
+		high = atoi(args[2]);
+		batch = nargs == 4 ? (unsigned)atoi(args[3]) : pageout_batch;
+		if (low == 0 || high < low || high >= coremap_total_pages() ||
+		    batch == 0 || batch > coremap_total_pages()) {
+			kprintf("pod: need 0 < lowwater <= highwater < %u, "
+				"0 < batch <= %u\n", coremap_total_pages(),
+				coremap_total_pages());
+			return EINVAL;
+		}
+		pageout_lowwater = low;
+		pageout_highwater = high;
+		pageout_batch = batch;
+	}
+	pageout_printstats();
+	return 0;
+}
+
 /*
  * Command for starting the system shell.
  */
@@ -405,6 +722,78 @@ cmd_kheapused(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for printing paging and page replacement statistics.
+ */
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	struct vm_faultstats st;
+	unsigned nslots, nused;
+
+	(void)nargs;
+	(void)args;
+
+	vm_getfaultstats(&st);
+	kprintf("faults: %u total, %u zero-filled, %u read from executables, "
+		"%u shared text, %u swapped in, %u first writes\n",
+		st.vfs_faults, st.vfs_zerofills, st.vfs_filepages,
+		st.vfs_textshared, st.vfs_pageins, st.vfs_dirtyfaults);
+	kprintf("zero pool: %u hits, %u misses, %u frames zeroed while idle\n",
+		st.vfs_zeropoolhits, st.vfs_zeropoolmisses,
+		st.vfs_zeropoolfills);
+	kprintf("copy-on-write: %u faults, %u pages copied\n",
+		st.vfs_cowfaults, st.vfs_cowcopies);
+	kprintf("clock: %u evictions (%u clean, %u dirty written back), "
+		"%u referenced bits cleared\n", st.vfs_evictions,
+		st.vfs_evictions - st.vfs_pageouts, st.vfs_pageouts,
+		st.vfs_refclears);
+	kprintf("pageout: %u dirty pages written back ahead of time\n",
+		st.vfs_precleans);
+	kprintf("tlb: %u fast refills, %u refills (%u prefetched), "
+		"%u flushes, %u shootdown IPIs\n", st.vfs_tlbfastrefills,
+		st.vfs_tlbrefills, st.vfs_tlbprefetches, st.vfs_tlbflushes,
+		st.vfs_shootdowns);
+	vm_printtlbstats();
+	if (swap_enabled()) {
+		swap_getstats(&nslots, &nused);
+		kprintf("swap: %u of %u pages in use\n", nused, nslots);
+	}
+	else {
+		kprintf("swap: none\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Command for printing the memory usage of each process.
+ */
+static
+int
+cmd_procusage(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	proc_printusage();
+
+	return 0;
+}
+
 static
 int
 cmd_kheapgeneration(int nargs, char **args)
@@ -466,6 +855,15 @@ showmenu(const char *name, const char *x[])
 static const char *opsmenu[] = {
 	"[s]       Shell                     ",
 	"[p]       Other program             ",
+	"[fb]      Program fault benchmark   ",
+	"[cow]     Copy-on-write fork on/off ",
+	"[mi]      Multi-instance benchmark  ",
+	"[share]   Shared text pages on/off  ",
+	"[tlb]     Tagged TLB entries on/off ",
+	"[tlbpf]   TLB prefetch block size   ",
+	"[refill]  Fast TLB refill on/off    ",
+	"[zp]      Idle page zeroing on/off  ",
+	"[pod]     Pageout daemon tuning     ",
 	"[mount]   Mount a filesystem        ",
 	"[unmount] Unmount a filesystem      ",
 	"[bootfs]  Set \"boot\" filesystem     ",
@@ -499,6 +897,9 @@ static const char *testmenu[] = {
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
 	"[km5] kmalloc coremap alloc test    ",
+	"[cmb] Coremap allocator benchmark   ",
+	"[pidb] Pid allocation benchmark     ",
+	"[zsoak] Exit/reap soak test         ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -581,6 +982,9 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[cms] Coremap/page cache stats      ",
+	"[vms] Paging/replacement stats      ",
+	"[ps] Process memory usage           ",
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -617,6 +1021,15 @@ static struct {
 	/* operations */
 	{ "s",		cmd_shell },
 	{ "p",		cmd_prog },
+	{ "fb",		cmd_faultbench },
+	{ "cow",	cmd_cow },
+	{ "mi",		cmd_multiinstance },
+	{ "share",	cmd_share },
+	{ "tlb",	cmd_tlb },
+	{ "tlbpf",	cmd_tlbprefetch },
+	{ "refill",	cmd_refill },
+	{ "zp",		cmd_zeropool },
+	{ "pod",	cmd_pageout },
 	{ "mount",	cmd_mount },
 	{ "unmount",	cmd_unmount },
 	{ "bootfs",	cmd_bootfs },
@@ -634,6 +1047,9 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "cms",        cmd_coremapstats },
+	{ "vms",        cmd_vmstats },
+	{ "ps",         cmd_procusage },
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -645,6 +1061,9 @@ static struct {
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
 	{ "km5",	kmalloctest5 },
+	{ "cmb",	coremapbench },
+	{ "pidb",	pidbench },
+	{ "zsoak",	zombiesoak },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -43,22 +43,93 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <spl.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <membar.h>
+#include <thread.h>
+#include <kern/file_syscalls.h>
 
 # define MAX_PROCS 128
 
+/*
+ * PIDs. A process lives in slot pid % MAX_PROCS of process_list; the rest
+ * of the pid is the slot's generation, bumped each time the slot is freed,
+ * so a pid is not handed out again until its slot has been reused
+ * PID_NGENS times. Free slots wait in a FIFO (pid_freeq), which also
+ * keeps a freed slot out of use for as long as any other slot is free.
+ * pid_lock covers the queue and the generations; get_pid_proc reads
+ * process_list without it.
+ */
+#define PID_NGENS	((PID_MAX + 1) / MAX_PROCS)
+#define PID_NSLOTS	(MAX_PROCS - PID_MIN)
+
 static struct proc* process_list[MAX_PROCS];
-static struct lock* pid_lock;
+static unsigned pid_gen[MAX_PROCS];
+static unsigned pid_freeq[PID_NSLOTS];
+static unsigned pid_freehead, pid_nfree;
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Orphans that have exited, waiting for the reaper thread to destroy
+ * them; linked through p_reapnext under pid_lock.
+ */
+static struct proc *reaper_list;
+static struct semaphore *reaper_sem;
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Give PROC the pid of the free slot that has waited longest, and publish
+ * it in process_list. Fails if every slot is taken.
+ */
+static
+int
+pid_alloc(struct proc *proc)
+{
+	unsigned slot;
+
+	spinlock_acquire(&pid_lock);
+	if(pid_nfree == 0){
+		spinlock_release(&pid_lock);
+		return ENPROC;
+	}
+	slot = pid_freeq[pid_freehead];
+	pid_freehead = (pid_freehead + 1) % PID_NSLOTS;
+	pid_nfree--;
+	proc->pid = pid_gen[slot] * MAX_PROCS + slot;
+	/* get_pid_proc must not see the proc before its fields */
+	membar_store_store();
+	process_list[slot] = proc;
+	spinlock_release(&pid_lock);
+	return 0;
+}
+
+/*
+ * Take PROC out of process_list and queue its slot, under a new
+ * generation, behind the other free slots.
+ */
+static
+void
+pid_free(struct proc *proc)
+{
+	unsigned slot = proc->pid % MAX_PROCS;
+
+	spinlock_acquire(&pid_lock);
+	KASSERT(process_list[slot] == proc);
+	process_list[slot] = NULL;
+	pid_gen[slot] = (pid_gen[slot] + 1) % PID_NGENS;
+	pid_freeq[(pid_freehead + pid_nfree) % PID_NSLOTS] = slot;
+	pid_nfree++;
+	spinlock_release(&pid_lock);
+}
+
 /*
  * Create a proc structure.
  */
@@ -86,20 +157,33 @@ proc_create(const char *name)
 
 	/* VFS fields */
 	proc->p_cwd = NULL;
+	proc->p_fdtable = NULL;
+
+	/* Memory usage */
+	bzero(&proc->p_vmstats, sizeof(proc->p_vmstats));
+	bzero(&proc->p_childusage, sizeof(proc->p_childusage));
+
+	/* Exit */
+	proc->has_exited = false;
+	proc->exit_code = 0;
+	proc->p_zombie = false;
+	proc->p_orphan = false;
+	proc->p_reapnext = NULL;
 
 	if(strcmp("[kernel]",name)){
-		lock_acquire(pid_lock);
-		int i = PID_MIN;
-		for(;i<MAX_PROCS;i++){
-			if(*(process_list+i) == NULL){
-				proc->pid = i;
-				*(process_list+i) = proc;
-				break;
-			}
-		}
 		proc->exit_sem = sem_create("exit semaphore",0);
+		if(proc->exit_sem == NULL){
+			kfree(proc->p_name);
+			kfree(proc);
+			return NULL;
+		}
 		proc->ppid = curproc->pid;
-		lock_release(pid_lock);
+		if(pid_alloc(proc)){
+			sem_destroy(proc->exit_sem);
+			kfree(proc->p_name);
+			kfree(proc);
+			return NULL;
+		}
 	}else{
 		proc->pid = 1;
 		proc->ppid = 0;
@@ -128,6 +212,9 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+	/* Unlisted first, so proc_printusage never sees it half torn down */
+	pid_free(proc);
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -139,6 +226,10 @@ proc_destroy(struct proc *proc)
 		VOP_DECREF(proc->p_cwd);
 		proc->p_cwd = NULL;
 	}
+	if (proc->p_fdtable) {
+		fdtable_destroy(proc->p_fdtable);
+		proc->p_fdtable = NULL;
+	}
 
 	/* VM fields */
 	if (proc->p_addrspace) {
@@ -182,8 +273,11 @@ proc_destroy(struct proc *proc)
 			as_deactivate();
 		}
 		else {
+			/* proc_getusage may be looking at it */
+			spinlock_acquire(&proc->p_lock);
 			as = proc->p_addrspace;
 			proc->p_addrspace = NULL;
+			spinlock_release(&proc->p_lock);
 		}
 		as_destroy(as);
 	}
@@ -192,11 +286,7 @@ proc_destroy(struct proc *proc)
 	spinlock_cleanup(&proc->p_lock);
 
 	kfree(proc->p_name);
-	
-	lock_acquire(pid_lock);
-	*(process_list+proc->pid) = NULL;
-	lock_release(pid_lock);
-	
+	sem_destroy(proc->exit_sem);
 	kfree(proc);
 
 
@@ -217,25 +307,310 @@ proc_bootstrap(void)
 
 void
 pid_allocation_bootstrap(void){
-	KASSERT(pid_lock == NULL);
-	pid_lock = lock_create("pid_lock");
-	if(pid_lock == NULL){
-		kprintf("pid_lock creation failed\n");
+	unsigned i;
+
+	for(i=0;i<MAX_PROCS;i++){
+		process_list[i] = NULL;
+		pid_gen[i] = 0;
 	}
-	int i=0;
-	for(;i<MAX_PROCS;i++){
-		*(process_list+i) = NULL;
+	/* Slots below PID_MIN would give pids that are reserved in generation 0 */
+	for(i=0;i<PID_NSLOTS;i++){
+		pid_freeq[i] = PID_MIN + i;
 	}
-	return;
+	pid_freehead = 0;
+	pid_nfree = PID_NSLOTS;
 }
 
+/*
+ * Look up a pid without taking pid_lock. The slot may hold a newer
+ * process by now, which the pid check weeds out; the caller has to know
+ * by other means (being its parent) that the process is not destroyed
+ * under it.
+ */
 struct proc*
 get_pid_proc(pid_t pid){
-	if(pid >= PID_MIN && pid < MAX_PROCS){
-		return *(process_list+pid);
-	}else{
+	struct proc *proc;
+
+	if(pid < PID_MIN || pid > PID_MAX){
 		return NULL;
 	}
+	proc = process_list[pid % MAX_PROCS];
+	membar_load_load();
+	if(proc == NULL || proc->pid != pid){
+		return NULL;
+	}
+	return proc;
+}
+
+/*
+ * Memory usage. Fault counts come from the process, resident set size and
+ * swap-outs from its address space, which p_lock keeps from going away
+ * while we look (see proc_destroy and proc_setas). Sizes go out in KB,
+ * as getrusage has them.
+ */
+void
+proc_getusage(struct proc *proc, struct rusage *ru)
+{
+	struct addrspace *as;
+	unsigned rss, maxrss, swapouts;
+
+	bzero(ru, sizeof(*ru));
+	spinlock_acquire(&proc->p_lock);
+	ru->ru_minflt = proc->p_vmstats.pv_minflt;
+	ru->ru_majflt = proc->p_vmstats.pv_majflt;
+	ru->ru_nswapin = proc->p_vmstats.pv_swapins;
+	ru->ru_ntlbmiss = proc->p_vmstats.pv_tlbmisses;
+	as = proc->p_addrspace;
+	if (as != NULL) {
+		as_getusage(as, &rss, &maxrss, &swapouts);
+	}
+	else {
+		rss = 0;
+		maxrss = proc->p_vmstats.pv_maxrss;
+		swapouts = proc->p_vmstats.pv_swapouts;
+	}
+	spinlock_release(&proc->p_lock);
+
+	ru->ru_rss = rss * (PAGE_SIZE / 1024);
+	ru->ru_maxrss = maxrss * (PAGE_SIZE / 1024);
+	ru->ru_nswapout = swapouts;
+}
+
+static
+void
+rusage_add(struct rusage *total, const struct rusage *ru)
+{
+	if (ru->ru_maxrss > total->ru_maxrss) {
+		total->ru_maxrss = ru->ru_maxrss;
+	}
+	total->ru_minflt += ru->ru_minflt;
+	total->ru_majflt += ru->ru_majflt;
+	total->ru_nswapin += ru->ru_nswapin;
+	total->ru_nswapout += ru->ru_nswapout;
+	total->ru_ntlbmiss += ru->ru_ntlbmiss;
+}
+
+void
+proc_addchildusage(struct proc *parent, struct proc *child)
+{
+	struct rusage ru;
+
+	proc_getusage(child, &ru);
+	rusage_add(&parent->p_childusage, &ru);
+	rusage_add(&parent->p_childusage, &child->p_childusage);
+}
+
+/* One line of proc_printusage, copied out from under pid_lock */
+#define PU_NAMELEN	24
+struct procusage {
+	pid_t pu_pid;
+	bool pu_exited;
+	struct rusage pu_ru;
+	char pu_name[PU_NAMELEN];
+};
+
+/*
+ * Print the process table. kprintf is slow (polled while a spinlock is
+ * held), so take a snapshot under pid_lock and print it after letting go.
+ */
+void
+proc_printusage(void)
+{
+	struct procusage *pu;
+	struct proc *proc;
+	size_t len;
+	int i, n;
+
+	pu = kmalloc(MAX_PROCS * sizeof(*pu));
+	if (pu == NULL) {
+		kprintf("proc_printusage: out of memory\n");
+		return;
+	}
+
+	n = 0;
+	spinlock_acquire(&pid_lock);
+	for (i = PID_MIN; i < MAX_PROCS; i++) {
+		proc = process_list[i];
+		if (proc == NULL) {
+			continue;
+		}
+		pu[n].pu_pid = proc->pid;
+		pu[n].pu_exited = proc->has_exited;
+		proc_getusage(proc, &pu[n].pu_ru);
+		len = strlen(proc->p_name);
+		if (len >= PU_NAMELEN) {
+			len = PU_NAMELEN - 1;
+		}
+		memcpy(pu[n].pu_name, proc->p_name, len);
+		pu[n].pu_name[len] = '\0';
+		n++;
+	}
+	spinlock_release(&pid_lock);
+
+	kprintf("  PID  RSS(K) MAXRSS(K)   MINFLT   MAJFLT  SWAPIN SWAPOUT  TLBMISS NAME\n");
+	for (i = 0; i < n; i++) {
+		kprintf("%5d %7u %9u %8u %8u %7u %7u %8u %s%s\n", pu[i].pu_pid,
+			(unsigned)pu[i].pu_ru.ru_rss,
+			(unsigned)pu[i].pu_ru.ru_maxrss,
+			(unsigned)pu[i].pu_ru.ru_minflt,
+			(unsigned)pu[i].pu_ru.ru_majflt,
+			(unsigned)pu[i].pu_ru.ru_nswapin,
+			(unsigned)pu[i].pu_ru.ru_nswapout,
+			(unsigned)pu[i].pu_ru.ru_ntlbmiss,
+			pu[i].pu_name, pu[i].pu_exited ? " (exited)" : "");
+	}
+	kfree(pu);
+}
+
+/*
+ * Exit and reaping.
+ *
+ * proc_exit frees everything a process no longer needs except the proc
+ * structure itself, which stays behind as a zombie holding the pid, the
+ * wait status and the usage counters. Once its last thread has let go
+ * (proc_remthread), the zombie is handed over: to the parent, which
+ * destroys it in proc_wait, or, if the parent exited first, to the
+ * reaper thread. pid_lock decides which of the two it is, since parent
+ * and child may be exiting at the same time.
+ */
+
+/* Queue an exited orphan for the reaper; caller holds pid_lock. */
+static
+void
+reaper_enqueue(struct proc *proc)
+{
+	proc->p_reapnext = reaper_list;
+	reaper_list = proc;
+	V(reaper_sem);
+}
+
+/* The last thread of the exited process PROC is gone. */
+static
+void
+proc_zombie(struct proc *proc)
+{
+	spinlock_acquire(&pid_lock);
+	proc->p_zombie = true;
+	if (proc->p_orphan) {
+		reaper_enqueue(proc);
+	}
+	else {
+		V(proc->exit_sem);
+	}
+	spinlock_release(&pid_lock);
+}
+
+static
+void
+reaper_thread(void *data1, unsigned long data2)
+{
+	struct proc *proc;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		P(reaper_sem);
+		spinlock_acquire(&pid_lock);
+		proc = reaper_list;
+		KASSERT(proc != NULL);
+		reaper_list = proc->p_reapnext;
+		spinlock_release(&pid_lock);
+		proc_destroy(proc);
+	}
+}
+
+void
+proc_reaper_bootstrap(void)
+{
+	int result;
+
+	reaper_sem = sem_create("reaper", 0);
+	if (reaper_sem == NULL) {
+		panic("proc_reaper_bootstrap: sem_create failed\n");
+	}
+	result = thread_fork("reaper", NULL, reaper_thread, NULL, 0);
+	if (result) {
+		panic("proc_reaper_bootstrap: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+}
+
+unsigned
+proc_count(void)
+{
+	unsigned count;
+
+	spinlock_acquire(&pid_lock);
+	count = PID_NSLOTS - pid_nfree;
+	spinlock_release(&pid_lock);
+	return count;
+}
+
+void
+proc_exit(int status)
+{
+	struct proc *proc = curproc;
+	struct proc *child;
+	struct addrspace *as;
+	struct vnode *cwd;
+	unsigned rss, i;
+
+	KASSERT(proc != NULL);
+	KASSERT(proc != kproc);
+
+	/* Keep what getrusage reports from the address space */
+	spinlock_acquire(&proc->p_lock);
+	as = proc->p_addrspace;
+	if (as != NULL) {
+		as_getusage(as, &rss, &proc->p_vmstats.pv_maxrss,
+			    &proc->p_vmstats.pv_swapouts);
+	}
+	proc->p_addrspace = NULL;
+	cwd = proc->p_cwd;
+	proc->p_cwd = NULL;
+	spinlock_release(&proc->p_lock);
+
+	/* As in proc_destroy: deactivate only once p_addrspace is clear */
+	if (as != NULL) {
+		as_deactivate();
+		as_destroy(as);
+	}
+	if (cwd != NULL) {
+		VOP_DECREF(cwd);
+	}
+
+	spinlock_acquire(&pid_lock);
+	for (i = PID_MIN; i < MAX_PROCS; i++) {
+		child = process_list[i];
+		if (child == NULL || child->ppid != proc->pid ||
+		    child->p_orphan) {
+			continue;
+		}
+		child->ppid = kproc->pid;
+		child->p_orphan = true;
+		if (child->p_zombie) {
+			reaper_enqueue(child);
+		}
+	}
+	proc->exit_code = status;
+	proc->has_exited = true;
+	spinlock_release(&pid_lock);
+}
+
+void
+proc_wait(struct proc *child, int *status)
+{
+	KASSERT(child != NULL);
+	KASSERT(!child->p_orphan);
+
+	P(child->exit_sem);
+	KASSERT(child->p_zombie);
+	if (status != NULL) {
+		*status = child->exit_code;
+	}
+	proc_addchildusage(curproc, child);
+	proc_destroy(child);
 }
 
 /*
@@ -315,6 +690,7 @@ void
 proc_remthread(struct thread *t)
 {
 	struct proc *proc;
+	bool last;
 	int spl;
 
 	proc = t->t_proc;
@@ -323,11 +699,17 @@ proc_remthread(struct thread *t)
 	spinlock_acquire(&proc->p_lock);
 	KASSERT(proc->p_numthreads > 0);
 	proc->p_numthreads--;
+	last = proc->p_numthreads == 0;
 	spinlock_release(&proc->p_lock);
 
 	spl = splhigh();
 	t->t_proc = NULL;
 	splx(spl);
+
+	/* From here on nothing refers to proc, so it may be destroyed */
+	if (last && proc->has_exited) {
+		proc_zombie(proc);
+	}
 }
 
 /*
@@ -7,6 +7,7 @@
 * 5. dup2
 * 6. chdir
 * 7. getcwd
+* 8. fsync
 **/
 
 #include <kern/file_syscalls.h>
@@ -23,134 +24,209 @@
 #include <uio.h>
 #include <proc.h>
 #include <kern/seek.h>
-/**
-*  This is called by runprogram.c and we are creating three file descriptors for STDIN, STDOUT, STDERR
-* and save them in positions 0, 1 and 2, respectively.
-**/
-int
-init_file_descriptor(void) {
-  struct vnode *vin;
-  struct vnode *vout;
-  struct vnode *verr;
-
-  char *in    = NULL;
-  char *out   = NULL;
-  char *err   = NULL;
-  in          = kstrdup("con:");
-  out         = kstrdup("con:");
-  err         = kstrdup("con:");
-
-  if (vfs_open(in,O_RDONLY,0664, &vin)) {
-    kfree(in);
-    kfree(out);
-    kfree(err);
-    return EINVAL; //still deciding on error return values
-
-  }
-/**Allocate memory for Fdesc 0 **/
-  curthread->t_fdtable[0] = (struct file_descriptor*)kmalloc(sizeof(struct file_descriptor));
-  if (curthread->t_fdtable[0] == NULL) { /** failed to allocate memory **/
-    kfree(in);
-    kfree(out);
-    kfree(err);
-    vfs_close(vin);
-    return EFAULT;
+#include <vm.h>
+#include <bitmap.h>
+#include <current.h>
+#include <pipe.h>
+/** --------------------------------------------------------------------------**/
+/** Open files and fd tables **/
+
+/** Make an open file for vn, with one reference **/
+static
+struct file_descriptor *
+file_create(const char *name, struct vnode *vn, int flags) {
+  struct file_descriptor *file;
+
+  file = (struct file_descriptor*)kmalloc(sizeof(struct file_descriptor));
+  if (file == NULL) {
+    return NULL;
+  }
+  file->lk = lock_create(name);
+  if (file->lk == NULL) {
+    kfree(file);
+    return NULL;
+  }
+  snprintf(file->fileName, sizeof(file->fileName), "%s", name);
+  file->vn        = vn;
+  file->openFlags = flags;
+  file->refCount  = 1;
+  file->offset    = 0;
+  return file;
+}
+
+static
+void
+file_incref(struct file_descriptor *file) {
+  lock_acquire(file->lk);
+  file->refCount++;
+  lock_release(file->lk);
+}
+
+/** Drop a reference; the last one closes the vnode **/
+static
+void
+file_decref(struct file_descriptor *file) {
+  bool last;
+
+  lock_acquire(file->lk);
+  KASSERT(file->refCount > 0);
+  file->refCount--;
+  last = file->refCount == 0;
+  lock_release(file->lk);
+
+  if (last) {
+    vfs_close(file->vn);
+    lock_destroy(file->lk);
+    kfree(file);
   }
-  strcpy(curthread->t_fdtable[0]->fileName,"con:");
-  curthread->t_fdtable[0]->vn        = vin;
-  curthread->t_fdtable[0]->openFlags = O_RDONLY;
-  curthread->t_fdtable[0]->refCount  = 1; // ref count set to 1, as it is only init once, and passed around after that
-  curthread->t_fdtable[0]->lk        = lock_create(in);
-  curthread->t_fdtable[0]->offset    = 0;
-
-  if (vfs_open(out,O_WRONLY,0664, &vout)) {
-    kfree(in);
-    kfree(out);
-    kfree(err);
-    lock_destroy(curthread->t_fdtable[0]->lk);
-    vfs_close(curthread->t_fdtable[0]->vn);
-    kfree(curthread->t_fdtable[0]);
-    curthread->t_fdtable[0] = NULL;
-    return EINVAL; //still deciding on error return values
-
-  }
-  /**Allocate memory for Fdesc 1 **/
-  curthread->t_fdtable[1] = (struct file_descriptor*)kmalloc(sizeof(struct file_descriptor));
-  if (curthread->t_fdtable[1] == NULL) { /** failed to allocate memory **/
-    kfree(in);
-    kfree(out);
-    kfree(err);
-    lock_destroy(curthread->t_fdtable[0]->lk);
-    vfs_close(curthread->t_fdtable[0]->vn);
-    kfree(curthread->t_fdtable[0]);
-    curthread->t_fdtable[0] = NULL;
-
-    vfs_close(vout);
-    return EFAULT;
+}
+
+static
+struct fdtable *
+fdtable_create(void) {
+  struct fdtable *ft;
+  int fd;
+
+  ft = (struct fdtable*)kmalloc(sizeof(struct fdtable));
+  if (ft == NULL) {
+    return NULL;
   }
-  strcpy(curthread->t_fdtable[1]->fileName,"con:");
-  curthread->t_fdtable[1]->vn        = vout;
-  curthread->t_fdtable[1]->openFlags = O_WRONLY;
-  curthread->t_fdtable[1]->refCount  = 1; // ref count set to 1, as it is only init once, and passed around after that
-  curthread->t_fdtable[1]->lk        = lock_create(out);
-  curthread->t_fdtable[1]->offset    = 0;
-
-  if (vfs_open(err,O_WRONLY,0664, &verr)) {
-    kfree(in);
-    kfree(out);
-    kfree(err);
-    lock_destroy(curthread->t_fdtable[0]->lk);
-    vfs_close(curthread->t_fdtable[0]->vn);
-    kfree(curthread->t_fdtable[0]);
-    curthread->t_fdtable[0]= NULL;
-
-    lock_destroy(curthread->t_fdtable[1]->lk);
-    vfs_close(curthread->t_fdtable[1]->vn);
-    kfree(curthread->t_fdtable[1]);
-    curthread->t_fdtable[1]= NULL;
-    return EINVAL; //still deciding on error return values
-  }
-
-  /**Allocate memory for Fdesc 1 **/
-  curthread->t_fdtable[2] = (struct file_descriptor*)kmalloc(sizeof(struct file_descriptor));
-  if (curthread->t_fdtable[2] == NULL) { /** failed to allocate memory **/
-    kfree(in);
-    kfree(out);
-    kfree(err);
-
-    lock_destroy(curthread->t_fdtable[0]->lk);
-    vfs_close(curthread->t_fdtable[0]->vn);
-    kfree(curthread->t_fdtable[0]);
-    curthread->t_fdtable[0]= NULL;
-
-    lock_destroy(curthread->t_fdtable[1]->lk);
-    vfs_close(curthread->t_fdtable[1]->vn);
-    kfree(curthread->t_fdtable[1]);
-    curthread->t_fdtable[1]= NULL;
-    return EFAULT;
+  ft->ft_used = bitmap_create(OPEN_MAX);
+  if (ft->ft_used == NULL) {
+    kfree(ft);
+    return NULL;
+  }
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    ft->ft_files[fd] = NULL;
   }
-  strcpy(curthread->t_fdtable[2]->fileName,"con:");
-  curthread->t_fdtable[2]->vn        = verr;
-  curthread->t_fdtable[2]->openFlags = O_WRONLY;
-  curthread->t_fdtable[2]->refCount  = 1; // ref count set to 1, as it is only init once, and passed around after that
-  curthread->t_fdtable[2]->lk        = lock_create(err);
-  curthread->t_fdtable[2]->offset    = 0;
+  return ft;
+}
 
+/** Give the current process's file the lowest free fd; the table keeps the
+* caller's reference **/
+static
+int
+fd_install(struct file_descriptor *file, int *retfd) {
+  struct fdtable *ft = curproc->p_fdtable;
+  unsigned fd;
+
+  if (bitmap_alloc(ft->ft_used, &fd)) {
+    return EMFILE;
+  }
+  ft->ft_files[fd] = file;
+  *retfd = fd;
   return 0;
 }
 
-/** --------------------------------------------------------------------------**/
+/** Take fd out of the current process's table and return its file, whose
+* reference passes to the caller **/
+static
+struct file_descriptor *
+fd_remove(int fd) {
+  struct fdtable *ft = curproc->p_fdtable;
+  struct file_descriptor *file;
+
+  file = ft->ft_files[fd];
+  ft->ft_files[fd] = NULL;
+  bitmap_unmark(ft->ft_used, fd);
+  return file;
+}
+
+/** For fork: a table sharing every open file of old **/
 int
-check_isFileHandleValid(int fHandle) {
-  if (fHandle >= OPEN_MAX || fHandle < 0) {
-    return EBADF;
+fdtable_copy(struct fdtable *old, struct fdtable **ret) {
+  struct fdtable *ft;
+  int fd;
+
+  if (old == NULL) {
+    *ret = NULL;
+    return 0;
+  }
+  ft = fdtable_create();
+  if (ft == NULL) {
+    return ENOMEM;
+  }
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    if (old->ft_files[fd] != NULL) {
+      file_incref(old->ft_files[fd]);
+      ft->ft_files[fd] = old->ft_files[fd];
+      bitmap_mark(ft->ft_used, fd);
+    }
+  }
+  *ret = ft;
+  return 0;
+}
+
+/** Close everything in ft and free it **/
+void
+fdtable_destroy(struct fdtable *ft) {
+  int fd;
+
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    if (ft->ft_files[fd] != NULL) {
+      file_decref(ft->ft_files[fd]);
+    }
   }
+  bitmap_destroy(ft->ft_used);
+  kfree(ft);
+}
 
-  if (curthread->t_fdtable[fHandle] == NULL) {
+/** The open file behind fd of the current process **/
+int
+fd_lookup(int fd, struct file_descriptor **ret) {
+  struct fdtable *ft = curproc->p_fdtable;
+
+  if (fd >= OPEN_MAX || fd < 0 || ft == NULL || ft->ft_files[fd] == NULL) {
     return EBADF;
   }
+  *ret = ft->ft_files[fd];
+  return 0;
+}
+
+/**
+*  This is called by runprogram.c: give the new process an fd table with the
+* console open as STDIN, STDOUT and STDERR, in positions 0, 1 and 2.
+**/
+int
+init_file_descriptor(void) {
+  static const int flags[3] = { O_RDONLY, O_WRONLY, O_WRONLY };
+  struct file_descriptor *file;
+  struct vnode *vn;
+  char path[5];
+  int i, fd, result;
+
+  KASSERT(curproc->p_fdtable == NULL);
+  curproc->p_fdtable = fdtable_create();
+  if (curproc->p_fdtable == NULL) {
+    return ENOMEM;
+  }
+  for (i = 0; i < 3; i++) {
+    /** vfs_open may scribble on the path **/
+    strcpy(path, "con:");
+    result = vfs_open(path, flags[i], 0664, &vn);
+    if (result) {
+      fd_closeall();
+      return result;
+    }
+    file = file_create("con:", vn, flags[i]);
+    if (file == NULL) {
+      vfs_close(vn);
+      fd_closeall();
+      return ENOMEM;
+    }
+    result = fd_install(file, &fd);
+    KASSERT(result == 0 && fd == i);
+  }
   return 0;
 }
+
+/** --------------------------------------------------------------------------**/
+int
+check_isFileHandleValid(int fHandle) {
+  struct file_descriptor *file;
+
+  return fd_lookup(fHandle, &file);
+}
 /** Remember, in case of failure, the return code must indicate error number
 In case of success, save the success status in retval**/
 
@@ -160,7 +236,7 @@ sys_open(const char *filename, int flags, mode_t mode, int *retval) {
   int index = 0,result;
   char* kbuff;
   struct vnode* vn;
-  //int readMode = 0;
+  struct file_descriptor *file;
   struct stat file_stat;
   (void)mode; // suppress warning, mode is unused
 
@@ -171,25 +247,20 @@ sys_open(const char *filename, int flags, mode_t mode, int *retval) {
   }
   result = copyin((const_userptr_t) filename, kbuff, PATH_MAX);
   if (result) {
-//    kprintf_n("%p",filename);
     kfree(kbuff);
-    //kprintf_n("Could not copy the filename to kbuff error is %d\n",result);
     return EFAULT; /* filename was an invalid pointer */
   }
   //check the flags
   if (flags < 0) {
     kprintf_n("Flags cannot be negative\n");
+    kfree(kbuff);
     return EINVAL;
   }
-
-  /** **/
-  while(curthread->t_fdtable[index] != NULL) {
-    index++;
-  }
-  if ( index == OPEN_MAX) {
-    *retval = 1; // error
-    return EMFILE; /* Too many open files */
+  if (curproc->p_fdtable == NULL) {
+    kfree(kbuff);
+    return EMFILE;
   }
+
   // create the vnode
   result = vfs_open(kbuff,flags,0664, &vn);
   if (result) {
@@ -198,78 +269,59 @@ sys_open(const char *filename, int flags, mode_t mode, int *retval) {
     kfree(kbuff);
     return result;
   }
-  curthread->t_fdtable[index] = (struct file_descriptor*)kmalloc(sizeof(struct file_descriptor));
-  if (curthread->t_fdtable[index] == NULL) {
+  file = file_create(kbuff, vn, flags); // never trust user buffers, always use kbuff
+  kfree(kbuff);
+  if (file == NULL) {
     kprintf_n("Could not create new file descriptor in sys_open\n");
-    kfree(kbuff);
     vfs_close(vn);
-    return EFAULT;
+    return ENOMEM;
   }
-  strcpy(curthread->t_fdtable[index]->fileName, kbuff);
-  curthread->t_fdtable[index]->vn        = vn;
-  curthread->t_fdtable[index]->openFlags = flags;
-  curthread->t_fdtable[index]->refCount  = 1; // ref count set to 1, as it is only init once, and passed around after that
-  curthread->t_fdtable[index]->lk        = lock_create(kbuff); // never trust user buffers, always use kbuff
-  if (flags && O_APPEND == O_APPEND) { //set offset to end of file
-    /*file_stat = (struct stat *)kmalloc(sizeof(struct stat));
-    if (file_stat == NULL) {
-      kprintf_n("Unable to allocate memory for stat\n");
-      kfree(kbuff);
-      lock_destroy(curthread->t_fdtable[index]->lk);
-      vfs_close(curthread->t_fdtable[index]->vn);
-      kfree(curthread->t_fdtable[index]);
-      curthread->t_fdtable[index] = NULL;
-      return EFAULT;
-    }*/
-    result = VOP_STAT(curthread->t_fdtable[index]->vn,&file_stat);
+  if (flags & O_APPEND) { //set offset to end of file
+    result = VOP_STAT(vn,&file_stat);
     if (result) {
       kprintf_n("Unable to stat file for getting offset\n");
-      kfree(kbuff);
-      //kfree(file_stat);
-      lock_destroy(curthread->t_fdtable[index]->lk);
-      vfs_close(curthread->t_fdtable[index]->vn);
-      kfree(curthread->t_fdtable[index]);
-      curthread->t_fdtable[index] = NULL;
-      return EFAULT;
+      file_decref(file);
+      return result;
     }
-    curthread->t_fdtable[index]->offset    = file_stat.st_size; // gives file size ** TODO : Test this ** /
-  } else {
-    curthread->t_fdtable[index]->offset    = 0;
+    file->offset = file_stat.st_size;
   }
 
+  result = fd_install(file, &index);
+  if (result) {
+    file_decref(file);
+    return result; /* Too many open files */
+  }
   *retval = index; /** return file handle on success**/
-  kfree(kbuff);
-  //kfree(file_stat);
   return 0;
 }
 
 /** System call for closing the file handle **/
 int
 sys_close(int fHandle,int *retval) {
-  int result = 1;
-  result = check_isFileHandleValid(fHandle);
-  if (result > 0) {
+  struct file_descriptor *file;
+  int result;
+
+  result = fd_lookup(fHandle, &file);
+  if (result) {
     kprintf_n("file handle passed in not valid in sys_close!\n");
     return result;
   }
-  if (curthread->t_fdtable[fHandle]->vn == NULL) {
-    //*retval = 1; // for any future uses
-    kprintf_n("vnode is NULL in sys_close \n");
-    return EBADF;
-  }
-  curthread->t_fdtable[fHandle]->refCount = curthread->t_fdtable[fHandle]->refCount-1;
-  if (curthread->t_fdtable[fHandle]->refCount == 0) {
-    vfs_close(curthread->t_fdtable[fHandle]->vn);
-    lock_destroy(curthread->t_fdtable[fHandle]->lk);
-    curthread->t_fdtable[fHandle]->refCount  = 0;
-    curthread->t_fdtable[fHandle]->openFlags = 0; // probably not required, but I like to clean up
-    curthread->t_fdtable[fHandle]->offset    = 0;
-    kfree(curthread->t_fdtable[fHandle]);
-    curthread->t_fdtable[fHandle] = NULL;
-  }
+  file_decref(fd_remove(fHandle));
   *retval = 0;
-  result  = 0;
-  return result;
+  return 0;
+}
+
+/** Close every open file handle of the current process and free its table;
+* used by _exit so the files go at exit, not when the parent gets round to
+* waiting **/
+void
+fd_closeall(void) {
+  struct fdtable *ft = curproc->p_fdtable;
+
+  if (ft != NULL) {
+    curproc->p_fdtable = NULL;
+    fdtable_destroy(ft);
+  }
 }
 
 /** Function similiar to uio_kinit, only difference is this will initialize a uio for usage with user-space
@@ -294,98 +346,193 @@ uio_uinit(struct iovec *iov, struct uio *uio,
   uio->uio_resid = len;
   uio->uio_space = curthread->t_proc->p_addrspace;
 }
-/** system call function for  sys_write
-* Note : ssize_t is a typecast for int
-*/
-ssize_t
-sys_write(int fd, const void *buf, size_t nbytes, int *retval) {
+/** Most iovecs a readv/writev can pass without kmalloc'ing a kernel copy **/
+#define FILE_SMALLIOV 8
+
+/**
+* Read or write a list of user buffers. With POSITIONAL the offset comes from
+* the caller and file->offset is neither read nor updated, so file->lk is not
+* taken and processes sharing an open file can read or write disjoint ranges of
+* it at the same time (the vnode does its own locking). Otherwise this is
+* read/write over several buffers, at the shared offset under file->lk.
+* Pipes have no offset and do their own synchronization, so they skip
+* file->lk and go straight to pipe_io.
+* The iovecs are kernel copies and get consumed by uiomove.
+**/
+static
+int
+file_iov(int fd, struct iovec *iov, unsigned iovcnt, off_t offset,
+         bool positional, enum uio_rw rw, int *retval) {
+  struct file_descriptor *file;
+  struct uio user_uio;
+  size_t total = 0;
+  unsigned i;
+  bool ispipe;
   int result;
-  result = check_isFileHandleValid(fd);
+
+  result = fd_lookup(fd, &file);
   if (result > 0) {
-    kprintf_n("File handle is invalid in sys_write\n");
     return result;
   }
-  //kprintf_n("curthread->t_fdtable[fd]->openFlags %d\n",curthread->t_fdtable[fd]->openFlags);
-  /*if (curthread->t_fdtable[fd]->openFlags  == O_RDONLY) { // inappropriate permissions
-    kprintf_n("File permissions are invalid. Flags are read only in sys_write");
+  if (rw == UIO_READ && (file->openFlags & O_ACCMODE) == O_WRONLY) {
     return EBADF;
-  }*/
-  if ((curthread->t_fdtable[fd]->openFlags & O_ACCMODE) == 0) {
-    kprintf_n("File permissions are invalid. Flags are read only in sys_write\n");
+  }
+  if (rw == UIO_WRITE && (file->openFlags & O_ACCMODE) == O_RDONLY) {
     return EBADF;
   }
-  lock_acquire(curthread->t_fdtable[fd]->lk);
-  struct iovec iov;
-  struct uio user_uio;
+  ispipe = vnode_ispipe(file->vn);
+  if (positional) {
+    if (ispipe || !VOP_ISSEEKABLE(file->vn)) {
+      return ESPIPE;
+    }
+    if (offset < 0) {
+      return EINVAL;
+    }
+  }
+  /** the total goes back as an ssize_t, so it must fit in one **/
+  for (i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+    if (total < iov[i].iov_len || (ssize_t)total < 0) {
+      return EINVAL;
+    }
+  }
 
-  /** Write nbytes to UIO**/
-  uio_uinit(&iov,&user_uio,(userptr_t)buf,nbytes,curthread->t_fdtable[fd]->offset,UIO_WRITE);
-  result = VOP_WRITE(curthread->t_fdtable[fd]->vn,&user_uio);
-  if (result) {
-      //kfree(kbuff);
-      lock_release(curthread->t_fdtable[fd]->lk);
+  user_uio.uio_iov    = iov;
+  user_uio.uio_iovcnt = iovcnt;
+  user_uio.uio_segflg = UIO_USERSPACE;
+  user_uio.uio_rw     = rw;
+  user_uio.uio_resid  = total;
+  user_uio.uio_space  = curproc->p_addrspace;
+
+  if (ispipe) {
+    user_uio.uio_offset = 0;
+    result = pipe_io(file->vn, &user_uio);
+    if (result) {
       return result;
+    }
+    *retval = total - user_uio.uio_resid;
+    return 0;
   }
-  *retval = nbytes - user_uio.uio_resid;
-  curthread->t_fdtable[fd]->offset = user_uio.uio_offset;
-  //kfree(kbuff);
-  lock_release(curthread->t_fdtable[fd]->lk);
+
+  if (!positional) {
+    lock_acquire(file->lk);
+    offset = file->offset;
+  }
+  user_uio.uio_offset = offset;
+  if (rw == UIO_READ) {
+    result = VOP_READ(file->vn, &user_uio);
+  }
+  else {
+    result = VOP_WRITE(file->vn, &user_uio);
+  }
+  if (!positional) {
+    if (result == 0) {
+      file->offset = user_uio.uio_offset;
+    }
+    lock_release(file->lk);
+  }
+  if (result) {
+    return result;
+  }
+  *retval = total - user_uio.uio_resid;
   return 0;
 }
 
-/** system call function for  sys_write
-* Note : ssize_t is a typecast for int
-*/
-ssize_t
-sys_read(int fd, void *buf, size_t nbytes, int *retval) {
+/**
+* readv/writev/preadv/pwritev: copy the user's iovec array in with a single
+* copyin, onto the stack when it is short, and hand it to file_iov.
+**/
+static
+int
+file_uiov(int fd, const struct iovec *uiov, int iovcnt, off_t offset,
+          bool positional, enum uio_rw rw, int *retval) {
+  struct iovec smalliov[FILE_SMALLIOV];
+  struct iovec *iov = smalliov;
   int result;
-  result = check_isFileHandleValid(fd);
-  if (result > 0) {
-    kprintf_n("File handle invalid in sys_read\n");
-    return result;
+
+  if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+    return EINVAL;
   }
-  //kprintf_n("Flags passed are %d\n",curthread->t_fdtable[fd]->openFlags);
-  /*if ((curthread->t_fdtable[fd]->openFlags  != O_RDONLY) && (curthread->t_fdtable[fd]->openFlags  != O_RDWR)) {
-    kprintf_n("Flags are invalid in sys_read %d\n",curthread->t_fdtable[fd]->openFlags);
-    return EBADF;
-  }*/
-  //void *kbuff;
-  /**this is a clever way to get around the fact that we are not aware
-  * of the "type" of data to write. *buf points to first location of buf, thus sizeof(*buf) gives size of the primitive
-  * held in buf. Then, it is straight forward to allocate kbuff the required number of bytes**/
-  /*kbuff = (char *)kmalloc(sizeof(*buf)*nbytes);
-  if (kbuff == NULL) {
-    kprintf_n("Could not allocate kbuff to sys_read\n");
-    return EFAULT;
+  if (iovcnt > FILE_SMALLIOV) {
+    iov = kmalloc(iovcnt * sizeof(*iov));
+    if (iov == NULL) {
+      return ENOMEM;
+    }
   }
-  if (copyin((const_userptr_t) buf, kbuff, sizeof(kbuff) ) ) {
-    kprintf_n("Could not copy the buffer to kbuff in sys_read\n");
-    return EFAULT;
-  }*/
-  /** check the flags **/
-  if ((curthread->t_fdtable[fd]->openFlags & O_WRONLY) == O_WRONLY) {
-    kprintf_n("File opened with write-only\n");
-    return EBADF;
+  result = copyin((const_userptr_t)uiov, iov, iovcnt * sizeof(*iov));
+  if (result == 0) {
+    result = file_iov(fd, iov, iovcnt, offset, positional, rw, retval);
+  }
+  if (iov != smalliov) {
+    kfree(iov);
   }
+  return result;
+}
 
-  lock_acquire(curthread->t_fdtable[fd]->lk);
+/** System call for write: one buffer at the shared offset **/
+ssize_t
+sys_write(int fd, const void *buf, size_t nbytes, int *retval) {
   struct iovec iov;
-  struct uio user_uio;
 
-  /** Read nbytes from UIO**/
-  uio_uinit(&iov,&user_uio,(userptr_t)buf,nbytes,curthread->t_fdtable[fd]->offset,UIO_READ);
-  result = VOP_READ(curthread->t_fdtable[fd]->vn,&user_uio);
-  if (result) {
-      //kfree(kbuff);
-      lock_release(curthread->t_fdtable[fd]->lk);
-      return result;
-  }
-  *retval = nbytes - user_uio.uio_resid;
-  curthread->t_fdtable[fd]->offset = user_uio.uio_offset;
-  //kfree(kbuff);
-  lock_release(curthread->t_fdtable[fd]->lk);
-  return 0;
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = nbytes;
+  return file_iov(fd, &iov, 1, 0, false, UIO_WRITE, retval);
+}
+
+/** System call for read: one buffer at the shared offset **/
+ssize_t
+sys_read(int fd, void *buf, size_t nbytes, int *retval) {
+  struct iovec iov;
+
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = nbytes;
+  return file_iov(fd, &iov, 1, 0, false, UIO_READ, retval);
+}
+
+/** System call for pread **/
+ssize_t
+sys_pread(int fd, void *buf, size_t nbytes, off_t offset, int *retval) {
+  struct iovec iov;
+
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = nbytes;
+  return file_iov(fd, &iov, 1, offset, true, UIO_READ, retval);
+}
+
+/** System call for pwrite **/
+ssize_t
+sys_pwrite(int fd, const void *buf, size_t nbytes, off_t offset, int *retval) {
+  struct iovec iov;
 
+  iov.iov_ubase = (userptr_t)buf;
+  iov.iov_len = nbytes;
+  return file_iov(fd, &iov, 1, offset, true, UIO_WRITE, retval);
+}
+
+/** System call for readv **/
+ssize_t
+sys_readv(int fd, const struct iovec *iov, int iovcnt, int *retval) {
+  return file_uiov(fd, iov, iovcnt, 0, false, UIO_READ, retval);
+}
+
+/** System call for writev **/
+ssize_t
+sys_writev(int fd, const struct iovec *iov, int iovcnt, int *retval) {
+  return file_uiov(fd, iov, iovcnt, 0, false, UIO_WRITE, retval);
+}
+
+/** System call for preadv **/
+ssize_t
+sys_preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+           int *retval) {
+  return file_uiov(fd, iov, iovcnt, offset, true, UIO_READ, retval);
+}
+
+/** System call for pwritev **/
+ssize_t
+sys_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset,
+            int *retval) {
+  return file_uiov(fd, iov, iovcnt, offset, true, UIO_WRITE, retval);
 }
 
 /** System call for sys_chdir **/
@@ -417,9 +564,10 @@ int sys_chdir(const char *pathname, int *retval) {
 /** System call for lseek**/
 off_t
 sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval2) {
+  struct file_descriptor *file;
   int result;
   kprintf_n("fd %d\n",fd);
-  result = check_isFileHandleValid(fd);
+  result = fd_lookup(fd, &file);
   if (result > 0) {
     return result;
   }
@@ -433,9 +581,9 @@ sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval2) {
   }
   /*offset itself can be negative. The resultant seek position however, cannot be. This is also verified in man
   * pages "Note that pos is a signed quantity."*/
-  lock_acquire(curthread->t_fdtable[fd]->lk);
-  if (!VOP_ISSEEKABLE(curthread->t_fdtable[fd]->vn)) {
-    lock_release(curthread->t_fdtable[fd]->lk);
+  lock_acquire(file->lk);
+  if (!VOP_ISSEEKABLE(file->vn)) {
+    lock_release(file->lk);
     kprintf_n("File does not support seeking \n");
     return ESPIPE;
   }
@@ -444,36 +592,90 @@ sys_lseek(int fd, off_t pos, int whence, int *retval1, int *retval2) {
   if (whence == SEEK_SET) {
     newPos = pos;
   } else if (whence == SEEK_CUR) {
-    newPos = curthread->t_fdtable[fd]->offset + pos;
+    newPos = file->offset + pos;
   } else if (whence == SEEK_END) {
-    result = VOP_STAT(curthread->t_fdtable[fd]->vn,&file_stat);
+    result = VOP_STAT(file->vn,&file_stat);
     if (result) {
       kprintf_n("Unable to stat file for getting offset\n");
-      lock_release(curthread->t_fdtable[fd]->lk);
+      lock_release(file->lk);
       return result;
     }
     newPos = file_stat.st_size + pos;
-    //curthread->t_fdtable[fd]->offset =
+    //file->offset =
   }
   if (newPos < (off_t)0) {
     kprintf_n("Resulting seek would be negative\n");
-    lock_release(curthread->t_fdtable[fd]->lk);
+    lock_release(file->lk);
     return EINVAL;
   }
-  curthread->t_fdtable[fd]->offset = newPos;
+  file->offset = newPos;
   *retval1 = (uint32_t)((newPos & 0xFFFFFFFF00000000) >> 32); // higher 32 bits
   *retval2 = (uint32_t)(newPos & 0x0FFFFFFFFF) ; //lower 32 bits
 
-  lock_release(curthread->t_fdtable[fd]->lk);
+  lock_release(file->lk);
   return 0;
 }
 
-/** System call for dup2**/
+/** System call for pipe: filehandles[0] gets the read end and filehandles[1]
+* the write end **/
+int
+sys_pipe(int *filehandles, int *retval) {
+  struct vnode *rvn, *wvn;
+  struct file_descriptor *rfile, *wfile;
+  int fds[2];
+  int result;
+
+  if (curproc->p_fdtable == NULL) {
+    return EMFILE;
+  }
+  result = pipe_create(&rvn, &wvn);
+  if (result) {
+    return result;
+  }
+  rfile = file_create("pipe read", rvn, O_RDONLY);
+  if (rfile == NULL) {
+    vfs_close(rvn);
+    vfs_close(wvn);
+    return ENOMEM;
+  }
+  wfile = file_create("pipe write", wvn, O_WRONLY);
+  if (wfile == NULL) {
+    file_decref(rfile);
+    vfs_close(wvn);
+    return ENOMEM;
+  }
+
+  result = fd_install(rfile, &fds[0]);
+  if (result) {
+    file_decref(rfile);
+    file_decref(wfile);
+    return result;
+  }
+  result = fd_install(wfile, &fds[1]);
+  if (result) {
+    file_decref(fd_remove(fds[0]));
+    file_decref(wfile);
+    return result;
+  }
+  result = copyout(fds, (userptr_t)filehandles, sizeof(fds));
+  if (result) {
+    file_decref(fd_remove(fds[0]));
+    file_decref(fd_remove(fds[1]));
+    return result;
+  }
+  *retval = 0;
+  return 0;
+}
+
+/** System call for dup2. Both handles then share one open file, offset
+* included **/
 int
 sys_dup2(int oldfd, int newfd, int *retval) {
+  struct file_descriptor *file, *oldfile;
+  struct fdtable *ft;
   int result;
 
-  result = check_isFileHandleValid(oldfd);
+  result = fd_lookup(oldfd, &file);
   if (result > 0) {
     return result;
   }
@@ -485,32 +687,18 @@ sys_dup2(int oldfd, int newfd, int *retval) {
     *retval = newfd;
     return 0;
   }
-  int retval1;
-  lock_acquire(curthread->t_fdtable[oldfd]->lk);
-  if (curthread->t_fdtable[newfd] != NULL) {
-      result = sys_close(newfd,&retval1);
-      if (result) {
-        kprintf_n("Unable to close newfd handle in sys_dup2\n");
-        return EINVAL;
-      }
-  }
-  /** Allocate memory to newfd and copy everything from oldfd**/
-  curthread->t_fdtable[newfd] = (struct file_descriptor*)kmalloc(sizeof(struct file_descriptor));
-  if (curthread->t_fdtable[newfd] == NULL) {
-    kprintf_n("Could not create new file descriptor in sys_dup2\n");
-    lock_release(curthread->t_fdtable[oldfd]->lk);
-    return EFAULT;
+  file_incref(file);
+  ft = curproc->p_fdtable;
+  oldfile = ft->ft_files[newfd];
+  if (oldfile == NULL) {
+    bitmap_mark(ft->ft_used, newfd);
+  }
+  ft->ft_files[newfd] = file;
+  if (oldfile != NULL) {
+    file_decref(oldfile);
   }
-  strcpy(curthread->t_fdtable[newfd]->fileName, curthread->t_fdtable[oldfd]->fileName);
-  curthread->t_fdtable[newfd]->vn        = curthread->t_fdtable[oldfd]->vn;
-  curthread->t_fdtable[newfd]->openFlags = curthread->t_fdtable[oldfd]->openFlags;
-  curthread->t_fdtable[oldfd]->refCount  = curthread->t_fdtable[oldfd]->refCount + 1;
-  curthread->t_fdtable[newfd]->refCount  = 1;
-  curthread->t_fdtable[newfd]->lk        = lock_create(curthread->t_fdtable[newfd]->fileName); // never trust user buffers, always use kbuff
 
   *retval = newfd;
-  lock_release(curthread->t_fdtable[oldfd]->lk);
-
   return 0;
 }
 
@@ -556,3 +744,33 @@ sys__getcwd(char *buf, size_t buflen, int *retval) {
   return 0;
 
 }
+
+/** System call for fsync. Stores made through shared mappings of the file
+* are written back first, then the file system's own buffers**/
+int
+sys_fsync(int fd, int *retval) {
+  struct file_descriptor *file;
+  struct stat file_stat;
+  struct vnode *vn;
+  int result;
+
+  result = fd_lookup(fd, &file);
+  if (result > 0) {
+    return result;
+  }
+  vn = file->vn;
+  result = VOP_STAT(vn, &file_stat);
+  if (result) {
+    return result;
+  }
+  result = vm_syncfile(vn, 0, ROUNDUP(file_stat.st_size, PAGE_SIZE) / PAGE_SIZE);
+  if (result) {
+    return result;
+  }
+  result = VOP_FSYNC(vn);
+  if (result) {
+    return result;
+  }
+  *retval = 0;
+  return 0;
+}
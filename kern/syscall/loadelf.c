@@ -37,6 +37,11 @@
  *    - then it loads each chunk of the program;
  *    - finally, as_complete_load.
  *
+ * With the real VM system, as_define_region is also told where in the
+ * file each segment lives and pages are read in by the fault handler
+ * when they are first touched, so nothing is loaded here. Only dumbvm
+ * still loads the segments eagerly.
+ *
  * This gives the VM code enough flexibility to deal with even grossly
  * mis-linked executables if that proves desirable. Under normal
  * circumstances, as_prepare_load and as_complete_load probably don't
@@ -74,6 +79,7 @@
  * change this code to not use uiomove, be sure to check for this case
  * explicitly.
  */
+#if OPT_DUMBVM
 static
 int
 load_segment(struct addrspace *as, struct vnode *v,
@@ -144,6 +150,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 
 	return result;
 }
+#endif /* OPT_DUMBVM */
 
 /*
  * Load an ELF executable user program into the current address space.
@@ -216,7 +223,6 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * might have a larger structure, so we must use e_phentsize
 	 * to find where the phdr starts.
 	 */
-	kprintf("eh.e_phnum %d", eh.e_phnum);
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
@@ -242,12 +248,16 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 				ph.p_type);
 			return ENOEXEC;
 		}
-		kprintf("ph.p_vaddr %p",(void *)ph.p_vaddr);
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
+		}
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_flags & PF_R,
 					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+					  ph.p_flags & PF_X,
+					  v, ph.p_offset, ph.p_filesz);
 		if (result) {
 			return result;
 		}
@@ -258,6 +268,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		return result;
 	}
 
+#if OPT_DUMBVM
 	/*
 	 * Now actually load each segment.
 	 */
@@ -295,6 +306,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return result;
 		}
 	}
+#endif /* OPT_DUMBVM */
 
 	result = as_complete_load(as);
 	if (result) {
@@ -8,6 +8,7 @@
 **/
 
 #include <kern/proc_syscalls.h>
+#include <kern/file_syscalls.h>
 #include <kern/errno.h>
 #include <types.h>
 #include <addrspace.h>
@@ -38,14 +39,27 @@ sys_fork(struct trapframe* parent_tf, int *retval){
 	int error;
 	struct proc *child_proc = proc_create_runprogram("child process");
 	struct trapframe* child_trapframe = NULL;
-	
+
+	if(child_proc == NULL){
+		*retval = -1;
+		return ENOMEM;
+	}
 	error = as_copy(curproc->p_addrspace, &(child_proc->p_addrspace));
 	if(error){
+		proc_destroy(child_proc);
+		*retval = -1;
+		return error;
+	}
+	/* The child shares the parent's open files, offsets included */
+	error = fdtable_copy(curproc->p_fdtable, &(child_proc->p_fdtable));
+	if(error){
+		proc_destroy(child_proc);
 		*retval = -1;
 		return error;
 	}
 	child_trapframe = (struct trapframe*)kmalloc(sizeof(struct trapframe));
 	if(child_trapframe == NULL){
+		proc_destroy(child_proc);
 		*retval = -1;
 		return ENOMEM;
 	}
@@ -56,7 +70,7 @@ sys_fork(struct trapframe* parent_tf, int *retval){
 
 	if(error){
 		kfree(child_trapframe);
-		as_destroy(child_proc->p_addrspace);
+		proc_destroy(child_proc);
 		*retval = -1;
 		return error;
 	}
@@ -78,15 +92,16 @@ void child_fork_entry(void *data1, unsigned long data2){
 	as_activate();
 
 	temp_tf = *tf;
+	kfree(tf);
 	mips_usermode(&temp_tf);
 	return;
 }
 
 void
 sys__exit(int _exitcode){
-		curproc->has_exited = true;
-		curproc->exit_code = _MKWAIT_EXIT(_exitcode);
-		V(curproc->exit_sem);
+		/* Everything but the zombie goes now, not when the parent waits */
+		fd_closeall();
+		proc_exit(_MKWAIT_EXIT(_exitcode));
 		thread_exit();
 	return;
 }
@@ -94,51 +109,64 @@ sys__exit(int _exitcode){
 pid_t
 sys_waitpid(pid_t pid, int* status, int options, int *retval){
 
-	kprintf("pid: passed: %d , curproc->pid:%d, ppid:%d\n",pid,curproc->pid,curproc->ppid);
 	if(options != 0){
-		kprintf("Invalid options provided\n");
 		*retval = -1;
 		return EINVAL;
 	}
 
 	struct proc* pid_proc = get_pid_proc(pid);
-	if(pid_proc != NULL){
-		kprintf("pid_proc:pid %d, ppid:%d\n",pid_proc->pid,pid_proc->ppid);
-	}
 	if(pid < PID_MIN || pid > PID_MAX || pid_proc == NULL || pid == curproc->pid || pid == curproc->ppid){
-		kprintf("Trying to wait invalid pid or self");
 		*retval = -1;
 		return ESRCH;
 	}
 
 	if(curproc->pid != pid_proc->ppid){
-		kprintf("Trying to wait on a non-child process\n");
 		*retval = -1;
 		return ECHILD;
 	}
 
-	if(!pid_proc->has_exited){
-		P(pid_proc->exit_sem);
-	}
+	/* The menu waits with a kernel pointer (see common_prog) */
+	bool kernel_status = curproc == kproc;
+	int exit_code;
+
+	proc_wait(pid_proc, &exit_code);
 	if(status != NULL){
-		if(pid_proc->pid == 2 && pid_proc->ppid == 1){
-			*status = pid_proc->exit_code;
-			kprintf("special case\n");
+		if(kernel_status){
+			*status = exit_code;
 		}else{
-
-		int error = copyout((const void*)&(pid_proc->exit_code),
-			(userptr_t)status, sizeof(int));
-		if(error){
-			kprintf("SYS_waitpid: pid:%d ppid:%d\n",pid_proc->pid, pid_proc->ppid);
-			kprintf("SYS_waitpid: Invalid status pointer\n");
-			*retval = -1;
-			return EFAULT;
-		}
+			int error = copyout((const void*)&exit_code,
+				(userptr_t)status, sizeof(int));
+			if(error){
+				*retval = -1;
+				return EFAULT;
+			}
 		}
 	}
 
 	*retval = pid;
-	proc_destroy(pid_proc);
+	return 0;
+}
+
+int
+sys_getrusage(int who, userptr_t usage, int *retval){
+	struct rusage ru;
+	int error;
+
+	if(who == RUSAGE_SELF){
+		proc_getusage(curproc, &ru);
+	}else if(who == RUSAGE_CHILDREN){
+		ru = curproc->p_childusage;
+	}else{
+		*retval = -1;
+		return EINVAL;
+	}
+
+	error = copyout(&ru, usage, sizeof(ru));
+	if(error){
+		*retval = -1;
+		return error;
+	}
+	*retval = 0;
 	return 0;
 }
 
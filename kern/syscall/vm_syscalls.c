@@ -0,0 +1,184 @@
+/**
+* This file contains the address space system-calls implementation
+* 1. sbrk
+* 2. mmap
+* 3. munmap
+* 4. mprotect
+**/
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/vm_syscalls.h>
+#include <kern/file_syscalls.h>
+#include <lib.h>
+#include <proc.h>
+#include <thread.h>
+#include <current.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <vm.h>
+
+/*
+ * Move the heap break by AMOUNT bytes and return the old break. Growing
+ * only moves heapEnd; the new pages are zero-filled by vm_fault when they
+ * are first touched, so even a huge sbrk costs nothing up front. It is
+ * refused if it would run into the stack or could never be backed by
+ * free memory and swap. Shrinking releases the pages wholly above the new
+ * break right away.
+ */
+int
+sys_sbrk(intptr_t amount, int *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldend, newend, first, last;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+
+	oldend = as->heapEnd;
+	if (amount < 0) {
+		if ((vaddr_t)0 - (vaddr_t)amount > oldend - as->heapStart) {
+			return EINVAL;
+		}
+		newend = oldend + amount;
+		first = ROUNDUP(newend, PAGE_SIZE);
+		last = ROUNDUP(oldend, PAGE_SIZE);
+		if (last > first) {
+			vm_unmap(as, first, (last - first) / PAGE_SIZE);
+		}
+	}
+	else {
+		if ((vaddr_t)amount > as_heaplimit(as) - oldend) {
+			return ENOMEM;
+		}
+		newend = oldend + amount;
+		first = ROUNDUP(oldend, PAGE_SIZE);
+		last = ROUNDUP(newend, PAGE_SIZE);
+		if ((last - first) / PAGE_SIZE > vm_avail_pages()) {
+			return ENOMEM;
+		}
+	}
+
+	as->heapEnd = newend;
+	*retval = (int)oldend;
+	return 0;
+}
+
+/*
+ * Map LEN bytes of the file open on FD from OFFSET, or of zero-filled
+ * memory with MAP_ANON, and return the address. ADDR is only a hint and
+ * is ignored; the mapping goes below the stack (see as_map). Nothing is
+ * read here: pages come in from the file as they are first touched.
+ * With MAP_SHARED, stores go back to the file and are seen by every
+ * process mapping it; with MAP_PRIVATE they stay in a private copy.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+	 off_t offset, int *retval)
+{
+	struct addrspace *as;
+	struct file_descriptor *file;
+	struct vnode *vn = NULL;
+	int maxprot, result;
+	vaddr_t va;
+
+	(void)addr;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	if (len == 0 || len > as->as_stackbase || offset < 0 ||
+	    offset % PAGE_SIZE != 0) {
+		return EINVAL;
+	}
+	if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0 ||
+	    (flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANON)) != 0 ||
+	    ((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+		return EINVAL;
+	}
+
+	maxprot = PROT_READ | PROT_WRITE | PROT_EXEC;
+	if ((flags & MAP_ANON) == 0) {
+		result = fd_lookup(fd, &file);
+		if (result) {
+			return result;
+		}
+		if ((file->openFlags & O_ACCMODE) == O_WRONLY) {
+			return EACCES;
+		}
+		if ((flags & MAP_SHARED) && (file->openFlags & O_ACCMODE) != O_RDWR) {
+			maxprot &= ~PROT_WRITE;
+		}
+		if ((prot & ~maxprot) != 0) {
+			return EACCES;
+		}
+		vn = file->vn;
+		/* Only file systems that can page a file in and out say yes */
+		result = VOP_MMAP(vn);
+		if (result) {
+			return result;
+		}
+	}
+	else {
+		offset = 0;
+	}
+
+	result = as_map(as, ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE, prot, maxprot,
+			flags, vn, offset, &va);
+	if (result) {
+		return result;
+	}
+	*retval = (int)va;
+	return 0;
+}
+
+/*
+ * Remove the mappings in [ADDR, ADDR+LEN), writing back what was stored
+ * through shared file mappings.
+ */
+int
+sys_munmap(userptr_t addr, size_t len, int *retval)
+{
+	struct addrspace *as;
+	vaddr_t va = (vaddr_t)addr;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return EINVAL;
+	}
+	if (va % PAGE_SIZE != 0 || len == 0 || va >= USERSPACETOP ||
+	    len > USERSPACETOP - va) {
+		return EINVAL;
+	}
+
+	*retval = 0;
+	return as_unmap(as, va, ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE);
+}
+
+/*
+ * Change the protection of the mapped pages in [ADDR, ADDR+LEN).
+ */
+int
+sys_mprotect(userptr_t addr, size_t len, int prot, int *retval)
+{
+	struct addrspace *as;
+	vaddr_t va = (vaddr_t)addr;
+
+	as = proc_getas();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	if (va % PAGE_SIZE != 0 || len == 0 || va >= USERSPACETOP ||
+	    len > USERSPACETOP - va ||
+	    (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+		return EINVAL;
+	}
+
+	*retval = 0;
+	return as_protect(as, va, ROUNDUP(len, PAGE_SIZE) / PAGE_SIZE, prot);
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Benchmarks for the physical page allocator behind alloc_kpages() and
+ * free_kpages().
+ */
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <vm.h>
+#include <test.h>
+
+#define CMB_MINPAGES   16
+#define CMB_ROUNDS     32
+#define CMB_MAXRUN     8
+
+/* Cheap deterministic generator; we want the allocator in the profile, not random(). */
+static uint32_t cmb_seed;
+
+static
+uint32_t
+cmb_rand(void)
+{
+	cmb_seed = cmb_seed * 1103515245 + 12345;
+	return cmb_seed >> 8;
+}
+
+static
+void
+cmb_report(const char *what, unsigned npages, unsigned nallocs,
+	   const struct timespec *ts)
+{
+	kprintf("cmb: %-6s %5u pages: %7u allocs in ", what, npages, nallocs);
+	timespec_printrate(ts, nallocs, "allocs");
+}
+
+/*
+ * Fill a working set of NPAGES pages (in runs of MAXRUN pages or fewer),
+ * then free it again in scrambled order, CMB_ROUNDS times. Returns the
+ * number of pages actually allocated in the last round; less than NPAGES
+ * means we ran out of memory.
+ */
+static
+unsigned
+cmb_run(const char *what, unsigned npages, unsigned maxrun)
+{
+	struct timespec before, after, diff;
+	vaddr_t *blocks, tmp;
+	unsigned nblocks, used, nallocs, round, i, j, run;
+
+	blocks = kmalloc(npages * sizeof(vaddr_t));
+	if (blocks == NULL) {
+		return 0;
+	}
+
+	nallocs = 0;
+	used = 0;
+	cmb_seed = npages;
+	gettime(&before);
+	for (round = 0; round < CMB_ROUNDS; round++) {
+		used = 0;
+		for (nblocks = 0; used < npages; nblocks++) {
+			run = maxrun == 1 ? 1 : 1 + cmb_rand() % maxrun;
+			if (run > npages - used) {
+				run = npages - used;
+			}
+			blocks[nblocks] = alloc_kpages(run);
+			if (blocks[nblocks] == 0) {
+				break;
+			}
+			used += run;
+			nallocs++;
+		}
+		for (i = nblocks; i > 1; i--) {
+			j = cmb_rand() % i;
+			tmp = blocks[i - 1];
+			blocks[i - 1] = blocks[j];
+			blocks[j] = tmp;
+		}
+		for (i = 0; i < nblocks; i++) {
+			free_kpages(blocks[i]);
+		}
+		if (used < npages) {
+			break;
+		}
+	}
+	gettime(&after);
+	timespec_sub(&after, &before, &diff);
+
+	kfree(blocks);
+	if (used == npages) {
+		cmb_report(what, npages, nallocs, &diff);
+	}
+	return used;
+}
+
+/*
+ * cmb [maxpages]
+ *
+ * Measure allocations/sec at working sets of 16, 64, 256, ... pages, up
+ * to MAXPAGES or until physical memory runs out. Each size is run once
+ * with single-page allocations (the kmalloc refill pattern) and once
+ * with mixed runs of up to CMB_MAXRUN pages.
+ */
+int
+coremapbench(int nargs, char **args)
+{
+	unsigned npages, maxpages;
+
+	if (nargs > 2) {
+		kprintf("Usage: cmb [maxpages]\n");
+		return 0;
+	}
+	maxpages = nargs == 2 ? (unsigned)atoi(args[1]) : 0;
+
+	kprintf("Starting coremap allocator benchmark (%u bytes in use)...\n",
+		coremap_used_bytes());
+	for (npages = CMB_MINPAGES;
+	     maxpages == 0 || npages <= maxpages; npages *= 4) {
+		if (cmb_run("single", npages, 1) < npages) {
+			break;
+		}
+		if (cmb_run("mixed", npages, CMB_MAXRUN) < npages) {
+			break;
+		}
+	}
+	kprintf("Coremap allocator benchmark done (%u bytes in use).\n",
+		coremap_used_bytes());
+	return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/*
+ * Process tests: a benchmark for pid allocation, proc_create/proc_destroy
+ * as fork and waitpid use them, with more and more processes alive; and
+ * a soak test of exit and reaping.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
+#include <kern/proc_syscalls.h>
+#include <lib.h>
+#include <clock.h>
+#include <thread.h>
+#include <proc.h>
+#include <vm.h>
+#include <test.h>
+
+#define PB_ROUNDS      4096
+#define PB_MAXLIVE     256
+
+#define ZS_PROG        "/testbin/zombiesoak"
+#define ZS_SLACK       (4 * PAGE_SIZE)
+
+static
+void
+pb_report(unsigned nlive, unsigned ncreates, const struct timespec *ts)
+{
+	kprintf("pidb: %3u live: %5u creates in ", nlive, ncreates);
+	timespec_printrate(ts, ncreates, "creates");
+}
+
+/*
+ * Create and destroy a process PB_ROUNDS times while NLIVE others stay
+ * around. Each new pid has to be found by get_pid_proc, and the pid just
+ * freed must be neither found nor handed out again right away. Returns
+ * false if NLIVE processes could not be created.
+ */
+static
+bool
+pb_run(struct proc **live, unsigned nlive)
+{
+	struct timespec before, after, diff;
+	struct proc *proc;
+	pid_t lastpid = 0;
+	unsigned i, round;
+	bool ok = true;
+
+	for (i = 0; i < nlive; i++) {
+		live[i] = proc_create_runprogram("pidb");
+		if (live[i] == NULL) {
+			break;
+		}
+	}
+
+	if (i == nlive) {
+		gettime(&before);
+		for (round = 0; round < PB_ROUNDS; round++) {
+			proc = proc_create_runprogram("pidb");
+			if (proc == NULL) {
+				panic("pidb: proc_create failed with %u live\n",
+				      nlive);
+			}
+			if (proc->pid == lastpid) {
+				panic("pidb: pid %d reused at once\n",
+				      lastpid);
+			}
+			if (get_pid_proc(proc->pid) != proc) {
+				panic("pidb: pid %d not found\n", proc->pid);
+			}
+			lastpid = proc->pid;
+			proc_destroy(proc);
+			if (get_pid_proc(lastpid) != NULL) {
+				panic("pidb: pid %d found after destroy\n",
+				      lastpid);
+			}
+		}
+		gettime(&after);
+		timespec_sub(&after, &before, &diff);
+		pb_report(nlive, PB_ROUNDS, &diff);
+	}
+	else {
+		ok = false;
+	}
+
+	while (i > 0) {
+		proc_destroy(live[--i]);
+	}
+	return ok;
+}
+
+/*
+ * pidb
+ *
+ * Measure process creates/sec with 0, 1, 4, 16, ... processes alive,
+ * until the process table is nearly full.
+ */
+int
+pidbench(int nargs, char **args)
+{
+	struct proc **live;
+	unsigned nlive;
+
+	(void)args;
+	if (nargs != 1) {
+		kprintf("Usage: pidb\n");
+		return 0;
+	}
+
+	live = kmalloc(PB_MAXLIVE * sizeof(struct proc *));
+	if (live == NULL) {
+		return ENOMEM;
+	}
+
+	kprintf("Starting pid allocation benchmark...\n");
+	pb_run(live, 0);
+	for (nlive = 1; nlive <= PB_MAXLIVE; nlive *= 4) {
+		if (!pb_run(live, nlive)) {
+			break;
+		}
+	}
+	kprintf("Pid allocation benchmark done.\n");
+
+	kfree(live);
+	return 0;
+}
+
+static
+void
+zs_progthread(void *data1, unsigned long data2)
+{
+	int result;
+
+	(void)data2;
+
+	result = runprogram(data1);
+	kprintf("zsoak: running %s failed: %s\n", (char *)data1,
+		strerror(result));
+	sys__exit(1);
+}
+
+/*
+ * Run the soak program to completion and let everything it left for the
+ * reaper go away. Returns the program's exit status.
+ */
+static
+int
+zs_run(char *progname, unsigned nprocs, unsigned nthreads)
+{
+	struct proc *proc;
+	int status, result;
+
+	proc = proc_create_runprogram("zsoak");
+	if (proc == NULL) {
+		return ENOMEM;
+	}
+	result = thread_fork("zsoak", proc, zs_progthread, progname, 0);
+	if (result) {
+		proc_destroy(proc);
+		return result;
+	}
+	proc_wait(proc, &status);
+
+	while (proc_count() > nprocs) {
+		thread_yield();
+	}
+	thread_wait_for_count(nthreads);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		kprintf("zsoak: %s exited with status %d\n", progname, status);
+		return EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * zsoak
+ *
+ * Run ZS_PROG (/testbin/zombiesoak, 100000 fork/exit/waitpid cycles,
+ * every other one orphaning a grandchild) twice, and check that the
+ * memory in use after the second run is where the first left it. The
+ * first run warms up kmalloc and the caches; a leak of one page every
+ * few thousand cycles then shows.
+ */
+int
+zombiesoak(int nargs, char **args)
+{
+	char progname[] = ZS_PROG;
+	unsigned nprocs, nthreads, before, now;
+	int result;
+
+	(void)args;
+	if (nargs != 1) {
+		kprintf("Usage: zsoak\n");
+		return 0;
+	}
+
+	nprocs = proc_count();
+	nthreads = thread_count;
+	kprintf("Starting exit/reap soak test (warm-up run)...\n");
+	result = zs_run(progname, nprocs, nthreads);
+	if (result) {
+		return result;
+	}
+	before = coremap_used_bytes();
+
+	kprintf("zsoak: %u bytes in use, measured run...\n", before);
+	result = zs_run(progname, nprocs, nthreads);
+	if (result) {
+		return result;
+	}
+	now = coremap_used_bytes();
+
+	kprintf("zsoak: %u bytes in use before, %u after\n", before, now);
+	if (now > before + ZS_SLACK) {
+		kprintf("zsoak: FAILED, %u bytes leaked\n", now - before);
+		return 0;
+	}
+	kprintf("Exit/reap soak test done.\n");
+	return 0;
+}
@@ -48,6 +48,7 @@
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <mainbus.h>
 #include <vnode.h>
 
@@ -123,7 +124,6 @@ struct thread *
 thread_create(const char *name)
 {
 	struct thread *thread;
-	int i;
 	DEBUGASSERT(name != NULL);
 	if (strlen(name) > MAX_NAME_LENGTH) {
 		return NULL;
@@ -152,9 +152,7 @@ thread_create(const char *name)
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
 	/* If you add to struct thread, be sure to initialize here */
-	for(i= 0;i < OPEN_MAX; i++) {
-		thread->t_fdtable[i] = NULL;
-	}
+
 	return thread;
 }
 
@@ -186,12 +184,26 @@ cpu_create(unsigned hardware_number)
 	c->c_hardclocks = 0;
 	c->c_spinlocks = 0;
 
+	c->c_npagecache = 0;
+	c->c_pagecache_hits = 0;
+	c->c_pagecache_misses = 0;
+	c->c_pagecache_frees = 0;
+	c->c_pagecache_drains = 0;
+
+	c->c_asid_next = 1;
+	c->c_asid_gen = 1;
+	c->c_asid_cur = 0;
+	c->c_tlb_refills = 0;
+	c->c_tlb_flushes = 0;
+	c->c_tlb_prefetches = 0;
+
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_seq = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -454,6 +466,16 @@ thread_start_cpus(void)
 	thread_count = 1;
 }
 
+/*
+ * Return the cpu with the given software number.
+ */
+struct cpu *
+cpu_getnum(unsigned software_number)
+{
+	KASSERT(software_number < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, software_number);
+}
+
 /*
  * Make a thread runnable.
  *
@@ -532,13 +554,6 @@ thread_fork(const char *name,
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
 
-	for(int i=0 ;i<OPEN_MAX;i++){  
-	  if(curthread->t_fdtable[i]!=NULL){
-		curthread->t_fdtable[i]->refCount = curthread->t_fdtable[i]->refCount+1;
-		newthread->t_fdtable[i] = (struct file_descriptor*)kmalloc(sizeof(struct file_descriptor));
-		newthread->t_fdtable[i] = curthread->t_fdtable[i];
-	  }
-	}
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
 		proc = curthread->t_proc;
@@ -667,7 +682,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			/* Zero a page for the VM system rather than wait */
+			if (!vm_idle_zero()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -1161,26 +1179,41 @@ ipi_broadcast(int code)
 	}
 }
 
-void
+unsigned
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
+	unsigned ticket;
 	int n;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
 	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
+	if (n == TLBSHOOTDOWN_MAX || n == TLBSHOOTDOWN_ALL) {
 		target->c_numshootdown = TLBSHOOTDOWN_ALL;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+	/* Whichever batch picks this up will bump the count */
+	ticket = target->c_shootdown_seq;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+	return ticket;
+}
+
+bool
+ipi_tlbshootdown_done(struct cpu *target, unsigned ticket)
+{
+	bool done;
+
+	spinlock_acquire(&target->c_ipi_lock);
+	done = target->c_shootdown_seq != ticket;
+	spinlock_release(&target->c_ipi_lock);
+	return done;
 }
 
 void
@@ -1224,6 +1257,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_seq++;
 	}
 
 	curcpu->c_ipi_pending = 0;
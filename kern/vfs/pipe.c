@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes.
+ *
+ * The ring is single-producer/single-consumer: p_head only ever moves
+ * forward, stored only by the writer, and p_tail likewise by the
+ * reader, so a reader and a writer each work out how much they can
+ * move from the two counters and copy without any lock between them.
+ * Both are free-running; head - tail is the amount buffered.
+ *
+ * Several processes can hold the same end (through fork or dup2), so
+ * each end has a busy flag that lets one read and one write at a time
+ * in. That costs a spinlock on the way in and out, not a sleep lock.
+ *
+ * A side that finds the ring empty (or full) sets its sleeping flag
+ * under p_lock, then looks again before going to sleep; the other side
+ * looks at the flag after moving its counter and only takes p_lock to
+ * wake it when it is set. A full barrier on each side between the
+ * store and the load means one of them is bound to see the other's.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <stat.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <membar.h>
+#include <uio.h>
+#include <vnode.h>
+#include <pipe.h>
+
+#if (PIPE_SIZE & (PIPE_SIZE - 1)) != 0
+#error "PIPE_SIZE must be a power of two"
+#endif
+
+struct pipe {
+	char *p_buf;			/* PIPE_SIZE bytes of ring */
+	volatile unsigned p_head;	/* bytes ever written */
+	volatile unsigned p_tail;	/* bytes ever read */
+
+	struct spinlock p_lock;		/* for sleeping and the flags below */
+	struct wchan *p_rwchan;		/* readers wait here */
+	struct wchan *p_wwchan;		/* writers wait here */
+	volatile bool p_rsleeping;	/* reader asleep on an empty ring */
+	volatile bool p_wsleeping;	/* writer asleep on a full ring */
+	bool p_rbusy;			/* a read is in progress */
+	bool p_wbusy;			/* a write is in progress */
+	volatile bool p_rclosed;	/* read end shut */
+	volatile bool p_wclosed;	/* write end shut */
+
+	struct vnode p_rvn;		/* read end */
+	struct vnode p_wvn;		/* write end */
+};
+
+static const struct vnode_ops pipe_vnode_ops;
+
+static
+void
+pipe_destroy(struct pipe *p)
+{
+	wchan_destroy(p->p_rwchan);
+	wchan_destroy(p->p_wwchan);
+	spinlock_cleanup(&p->p_lock);
+	kfree(p->p_buf);
+	kfree(p);
+}
+
+int
+pipe_create(struct vnode **ret_read, struct vnode **ret_write)
+{
+	struct pipe *p;
+
+	p = kmalloc(sizeof(*p));
+	if (p == NULL) {
+		return ENOMEM;
+	}
+	p->p_buf = kmalloc(PIPE_SIZE);
+	if (p->p_buf == NULL) {
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_rwchan = wchan_create("pipe read");
+	if (p->p_rwchan == NULL) {
+		kfree(p->p_buf);
+		kfree(p);
+		return ENOMEM;
+	}
+	p->p_wwchan = wchan_create("pipe write");
+	if (p->p_wwchan == NULL) {
+		wchan_destroy(p->p_rwchan);
+		kfree(p->p_buf);
+		kfree(p);
+		return ENOMEM;
+	}
+	spinlock_init(&p->p_lock);
+	p->p_head = 0;
+	p->p_tail = 0;
+	p->p_rsleeping = false;
+	p->p_wsleeping = false;
+	p->p_rbusy = false;
+	p->p_wbusy = false;
+	p->p_rclosed = false;
+	p->p_wclosed = false;
+
+	vnode_init(&p->p_rvn, &pipe_vnode_ops, NULL, p);
+	vnode_init(&p->p_wvn, &pipe_vnode_ops, NULL, p);
+	*ret_read = &p->p_rvn;
+	*ret_write = &p->p_wvn;
+	return 0;
+}
+
+bool
+vnode_ispipe(struct vnode *vn)
+{
+	return vn->vn_ops == &pipe_vnode_ops;
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Take or give up our end's turn.
+ */
+static
+void
+pipe_enter(struct pipe *p, bool reader)
+{
+	bool *busy = reader ? &p->p_rbusy : &p->p_wbusy;
+	struct wchan *wc = reader ? p->p_rwchan : p->p_wwchan;
+
+	spinlock_acquire(&p->p_lock);
+	while (*busy) {
+		wchan_sleep(wc, &p->p_lock);
+	}
+	*busy = true;
+	spinlock_release(&p->p_lock);
+}
+
+static
+void
+pipe_leave(struct pipe *p, bool reader)
+{
+	bool *busy = reader ? &p->p_rbusy : &p->p_wbusy;
+	struct wchan *wc = reader ? p->p_rwchan : p->p_wwchan;
+
+	spinlock_acquire(&p->p_lock);
+	*busy = false;
+	wchan_wakeall(wc, &p->p_lock);
+	spinlock_release(&p->p_lock);
+}
+
+/*
+ * Whether the reader (or writer) has something to do: data (space) in
+ * the ring, or the other end shut.
+ */
+static
+bool
+pipe_ready(struct pipe *p, bool reader)
+{
+	if (reader) {
+		return p->p_head != p->p_tail || p->p_wclosed;
+	}
+	return p->p_head - p->p_tail < PIPE_SIZE || p->p_rclosed;
+}
+
+/*
+ * Sleep until the reader (or writer) is ready.
+ */
+static
+void
+pipe_wait(struct pipe *p, bool reader)
+{
+	volatile bool *sleeping = reader ? &p->p_rsleeping : &p->p_wsleeping;
+	struct wchan *wc = reader ? p->p_rwchan : p->p_wwchan;
+
+	spinlock_acquire(&p->p_lock);
+	*sleeping = true;
+	membar_any_any();
+	while (!pipe_ready(p, reader)) {
+		wchan_sleep(wc, &p->p_lock);
+	}
+	*sleeping = false;
+	spinlock_release(&p->p_lock);
+}
+
+/*
+ * Wake the reader (or writer) if it went to sleep; called after
+ * moving the other counter.
+ */
+static
+void
+pipe_wake(struct pipe *p, bool reader)
+{
+	volatile bool *sleeping = reader ? &p->p_rsleeping : &p->p_wsleeping;
+	struct wchan *wc = reader ? p->p_rwchan : p->p_wwchan;
+
+	membar_any_any();
+	if (*sleeping) {
+		spinlock_acquire(&p->p_lock);
+		wchan_wakeall(wc, &p->p_lock);
+		spinlock_release(&p->p_lock);
+	}
+}
+
+/*
+ * Read whatever is buffered, up to uio_resid, waiting only if nothing
+ * is. Returns with nothing read (EOF) once the write end is shut and
+ * the ring drained.
+ */
+static
+int
+pipe_read(struct pipe *p, struct uio *uio)
+{
+	size_t start = uio->uio_resid;
+	unsigned head, tail, off, len;
+	int result = 0;
+
+	pipe_enter(p, true);
+	while (uio->uio_resid > 0) {
+		tail = p->p_tail;
+		head = p->p_head;
+		if (head == tail) {
+			if (uio->uio_resid < start) {
+				break;
+			}
+			if (p->p_wclosed) {
+				/* the last write may have come just before */
+				membar_load_load();
+				if (p->p_head == tail) {
+					break;
+				}
+				continue;
+			}
+			pipe_wait(p, true);
+			continue;
+		}
+		/* see the data before the head that covers it */
+		membar_load_load();
+
+		off = tail % PIPE_SIZE;
+		len = head - tail;
+		if (len > PIPE_SIZE - off) {
+			len = PIPE_SIZE - off;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, len, uio);
+		if (result) {
+			break;
+		}
+		/* finish with the bytes before handing them back */
+		membar_any_store();
+		p->p_tail = tail + len;
+		pipe_wake(p, false);
+	}
+	pipe_leave(p, true);
+	return result;
+}
+
+/*
+ * Write all of uio, waiting for space as needed. EPIPE if the read end
+ * is shut before anything was written.
+ */
+static
+int
+pipe_write(struct pipe *p, struct uio *uio)
+{
+	size_t start = uio->uio_resid;
+	unsigned head, tail, off, len;
+	int result = 0;
+
+	pipe_enter(p, false);
+	while (uio->uio_resid > 0) {
+		if (p->p_rclosed) {
+			result = EPIPE;
+			break;
+		}
+		head = p->p_head;
+		tail = p->p_tail;
+		if (head - tail == PIPE_SIZE) {
+			pipe_wait(p, false);
+			continue;
+		}
+		/* don't overwrite bytes before the reader is done with them */
+		membar_any_store();
+
+		off = head % PIPE_SIZE;
+		len = PIPE_SIZE - (head - tail);
+		if (len > PIPE_SIZE - off) {
+			len = PIPE_SIZE - off;
+		}
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		result = uiomove(p->p_buf + off, len, uio);
+		if (result) {
+			break;
+		}
+		/* the data has to be there before the head says so */
+		membar_store_store();
+		p->p_head = head + len;
+		pipe_wake(p, true);
+	}
+	pipe_leave(p, false);
+	if (result == EPIPE && uio->uio_resid < start) {
+		/* report the partial write */
+		result = 0;
+	}
+	return result;
+}
+
+int
+pipe_io(struct vnode *vn, struct uio *uio)
+{
+	struct pipe *p = vn->vn_data;
+
+	KASSERT(vnode_ispipe(vn));
+
+	if (uio->uio_rw == UIO_READ) {
+		if (vn != &p->p_rvn) {
+			return EBADF;
+		}
+		return pipe_read(p, uio);
+	}
+	if (vn != &p->p_wvn) {
+		return EBADF;
+	}
+	return pipe_write(p, uio);
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * The last reference to one end is gone: shut it, wake whoever is
+ * waiting on the other, and free the pipe if that was shut already.
+ */
+static
+int
+pipe_reclaim(struct vnode *vn)
+{
+	struct pipe *p = vn->vn_data;
+	bool reader = vn == &p->p_rvn;
+	bool last;
+
+	vnode_cleanup(vn);
+
+	spinlock_acquire(&p->p_lock);
+	if (reader) {
+		p->p_rclosed = true;
+		wchan_wakeall(p->p_wwchan, &p->p_lock);
+	}
+	else {
+		p->p_wclosed = true;
+		wchan_wakeall(p->p_rwchan, &p->p_lock);
+	}
+	last = p->p_rclosed && p->p_wclosed;
+	spinlock_release(&p->p_lock);
+
+	if (last) {
+		pipe_destroy(p);
+	}
+	return 0;
+}
+
+static
+int
+pipe_eachopen(struct vnode *vn, int flags)
+{
+	/* Pipes are never opened by name. */
+	(void)vn;
+	(void)flags;
+	return EINVAL;
+}
+
+static
+int
+pipe_ioctl(struct vnode *vn, int op, userptr_t data)
+{
+	(void)vn;
+	(void)op;
+	(void)data;
+	return EINVAL;
+}
+
+static
+int
+pipe_gettype(struct vnode *vn, mode_t *result)
+{
+	(void)vn;
+	*result = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_stat(struct vnode *vn, struct stat *statbuf)
+{
+	struct pipe *p = vn->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_size = p->p_head - p->p_tail;
+	statbuf->st_blksize = PIPE_SIZE;
+	statbuf->st_nlink = 1;
+	return 0;
+}
+
+static
+bool
+pipe_isseekable(struct vnode *vn)
+{
+	(void)vn;
+	return false;
+}
+
+static
+int
+pipe_fsync(struct vnode *vn)
+{
+	(void)vn;
+	return 0;
+}
+
+static
+int
+pipe_truncate(struct vnode *vn, off_t len)
+{
+	(void)vn;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Function table for pipe vnodes. Reads and writes through VOP_READ
+ * and VOP_WRITE work, but the file layer calls pipe_io directly.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	.vop_magic = VOP_MAGIC,
+
+	.vop_eachopen = pipe_eachopen,
+	.vop_reclaim = pipe_reclaim,
+	.vop_read = pipe_io,
+	.vop_readlink = vopfail_uio_inval,
+	.vop_getdirentry = vopfail_uio_notdir,
+	.vop_write = pipe_io,
+	.vop_ioctl = pipe_ioctl,
+	.vop_stat = pipe_stat,
+	.vop_gettype = pipe_gettype,
+	.vop_isseekable = pipe_isseekable,
+	.vop_fsync = pipe_fsync,
+	.vop_mmap = vopfail_mmap_nosys,
+	.vop_truncate = pipe_truncate,
+	.vop_namefile = vopfail_uio_inval,
+	.vop_creat = vopfail_creat_notdir,
+	.vop_symlink = vopfail_symlink_notdir,
+	.vop_mkdir = vopfail_mkdir_notdir,
+	.vop_link = vopfail_link_notdir,
+	.vop_remove = vopfail_string_notdir,
+	.vop_rmdir = vopfail_string_notdir,
+	.vop_rename = vopfail_rename_notdir,
+	.vop_lookup = vopfail_lookup_notdir,
+	.vop_lookparent = vopfail_lookparent_notdir,
+};
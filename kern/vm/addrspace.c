@@ -29,6 +29,7 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
 #include <lib.h>
 #include <addrspace.h>
 #include <vm.h>
@@ -36,26 +37,150 @@
 #include <mips/tlb.h>
 #include <spl.h>
 #include <elf.h>
+#include <uio.h>
+#include <vnode.h>
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
  * assignment, this file is not compiled or linked or in any way
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
-/*Iterate through all PTE entries, invalidate their TLB entries
-Then use beloved "kfree" to invalidate coremap entries for all the physical entries*/
+/*Iterate through all PTE entries and release the frames, swap slots and
+the page table itself, then drop the TLB entries of the pages that were
+resident in one batch. Nothing runs in this address space any more, so the
+TLB can be dealt with last*/
 void
 deletePageTable(struct addrspace *as) {
-	struct page_table_entry *tempFirst = as->first;
-	struct page_table_entry *tempFree;
-	while(tempFirst != NULL	) {
-		tlb_shootdown_page_table_entry(tempFirst->va);
+	vaddr_t resident[TLBSHOOTDOWN_MAX];
+	unsigned nresident;
+	pte_t *table;
+	int i, j;
 
-		tempFree = tempFirst;
-		tempFirst= tempFirst->next;
-		kfree(tempFree);
+	if (as->pgdir == NULL) {
+		return;
+	}
+	nresident = 0;
+	for (i = 0; i < PT_NENTRIES; i++) {
+		table = as->pgdir[i];
+		if (table == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_NENTRIES; j++) {
+			if (table[j] == 0) {
+				continue;
+			}
+			if (table[j] & PTE_VALID) {
+				if (nresident < TLBSHOOTDOWN_MAX) {
+					resident[nresident] = PT_VADDR(i, j);
+				}
+				nresident++;
+			}
+			vm_freepte(as, &table[j]);
+		}
+	}
+	vm_asid_release(as, resident, nresident);
+	pgdir_destroy(as->pgdir);
+	as->pgdir = NULL;
+}
+
+/*
+ * Regions. An address space has any number of them in as_regions, sorted
+ * by address and never overlapping, so the fault handler finds the one
+ * holding an address by binary search. The array doubles when it fills.
+ * ELF segments (ar_flags 0) come first, then the heap, then mappings made
+ * by mmap(), then the stack.
+ */
+
+#define AS_MINREGIONS 4
+
+static
+vaddr_t
+as_region_end(const struct as_region *r)
+{
+	return r->ar_start + r->ar_npages * PAGE_SIZE;
+}
+
+/*
+ * Index of the first region that ends above VA: the one holding VA if
+ * there is one, otherwise the next one up, or as_nregions.
+ */
+static
+unsigned
+as_region_index(struct addrspace *as, vaddr_t va)
+{
+	unsigned lo, hi, mid;
+
+	lo = 0;
+	hi = as->as_nregions;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (va >= as_region_end(&as->as_regions[mid])) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
 	}
+	return lo;
+}
+
+static
+struct as_region *
+as_find(struct addrspace *as, vaddr_t va)
+{
+	unsigned i;
+
+	i = as_region_index(as, va);
+	if (i < as->as_nregions && va >= as->as_regions[i].ar_start) {
+		return &as->as_regions[i];
+	}
+	return NULL;
+}
 
+/*
+ * Put a copy of R at index I, moving the regions above it up. Pointers
+ * into the array are stale afterwards.
+ */
+static
+int
+as_region_insert(struct addrspace *as, unsigned i, const struct as_region *r)
+{
+	struct as_region *regions;
+	unsigned max;
+
+	KASSERT(i <= as->as_nregions);
+
+	if (as->as_nregions == as->as_maxregions) {
+		max = as->as_maxregions == 0 ? AS_MINREGIONS :
+			as->as_maxregions * 2;
+		regions = kmalloc(max * sizeof(*regions));
+		if (regions == NULL) {
+			return ENOMEM;
+		}
+		if (as->as_nregions > 0) {
+			memcpy(regions, as->as_regions,
+			       as->as_nregions * sizeof(*regions));
+		}
+		kfree(as->as_regions);
+		as->as_regions = regions;
+		as->as_maxregions = max;
+	}
+	memmove(&as->as_regions[i + 1], &as->as_regions[i],
+		(as->as_nregions - i) * sizeof(*r));
+	as->as_regions[i] = *r;
+	as->as_nregions++;
+	return 0;
+}
+
+static
+void
+as_region_remove(struct addrspace *as, unsigned i)
+{
+	KASSERT(i < as->as_nregions);
+
+	memmove(&as->as_regions[i], &as->as_regions[i + 1],
+		(as->as_nregions - i - 1) * sizeof(struct as_region));
+	as->as_nregions--;
 }
 
 /*%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*/
@@ -72,75 +197,171 @@ as_create(void)
 	/*
 	 * Initialize as needed.
 	 */
-	 as->first 		 		= NULL;
-	 /*Region 1*/
-	 as->as_vbase1 		= (vaddr_t)0;
-	 as->as_npages1		= 0;
-	 as->perm_region1 = 0;
-	 /*Region 2*/
-	 as->as_vbase2		= (vaddr_t)0;
-	 as->as_npages2		= 0;
-	 as->perm_region2 = 0;
+	 as->pgdir = pgdir_create();
+	 if (as->pgdir == NULL) {
+		 kfree(as);
+		 return NULL;
+	 }
+	 as->loading		= false;
+	 as->as_noaccess	= false;
+	 /*No regions yet*/
+	 as->as_regions		= NULL;
+	 as->as_nregions	= 0;
+	 as->as_maxregions	= 0;
 	 /*stack base + size*/
 	 as->as_stackbase = (vaddr_t)0;
 	 as->nStackPages	= 0;
 	 /*Heap base + size*/
 	 as->heapStart		= (vaddr_t)0;
 	 as->heapEnd			= (vaddr_t)0;
+	 /*No TLB address space IDs yet*/
+	 bzero(as->as_asids, sizeof(as->as_asids));
+	 /*Nothing resident*/
+	 as->as_rss		= 0;
+	 as->as_maxrss		= 0;
+	 as->as_swapouts	= 0;
 
 	return as;
 }
 
+/*
+ * Duplicate the page table of OLD into NEWAS. With vm_cow_enabled, every
+ * resident frame is shared and both PTEs are marked copy-on-write;
+ * otherwise each page is copied right away. Swapped-out pages get their
+ * own copy in swap. Pages of MAP_SHARED mappings end up in both.
+ */
+static
+int
+as_copy_pages(struct addrspace *old, struct addrspace *newas)
+{
+	struct as_region *r;
+	pte_t *table, *newpte;
+	vaddr_t va;
+	unsigned k;
+	int i, j, result;
+
+	/*Shared anonymous pages not touched yet would otherwise be zero-filled
+	separately in parent and child*/
+	for (k = 0; k < old->as_nregions; k++) {
+		r = &old->as_regions[k];
+		if ((r->ar_flags & MAP_SHARED) && r->ar_file.vn == NULL) {
+			result = vm_populate(old, r->ar_start, r->ar_npages);
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	for (i = 0; i < PT_NENTRIES; i++) {
+		table = old->pgdir[i];
+		if (table == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_NENTRIES; j++) {
+			if (table[j] == 0) {
+				continue;
+			}
+			va = PT_VADDR(i, j);
+			newpte = pgdir_lookup(newas->pgdir, va, true);
+			if (newpte == NULL) {
+				return ENOMEM;
+			}
+			r = as_find(old, va);
+			result = vm_copypte(newas, va, &table[j], newpte,
+					    r != NULL && (r->ar_flags & MAP_SHARED));
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	unsigned i;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
 
-	/*
-	 * Write this.
-	 */
-
-	//(void)old;
-	/*Since we do on-demand paging, now how we do allocate PTE for new AS ?*/
 	KASSERT(old != NULL);
-	newas->as_vbase1 = old->as_vbase1;
-	newas->as_npages1;
-	newas->perm_region1;
-	/*Region 2*/
-	newas->as_vbase2;
-	newas->as_npages2;
-	newas->perm_region2;
+	/*Regions; pages not touched yet still come from their files*/
+	if (old->as_nregions > 0) {
+		newas->as_regions = kmalloc(old->as_nregions *
+					    sizeof(struct as_region));
+		if (newas->as_regions == NULL) {
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		memcpy(newas->as_regions, old->as_regions,
+		       old->as_nregions * sizeof(struct as_region));
+		newas->as_nregions   = old->as_nregions;
+		newas->as_maxregions = old->as_nregions;
+		for (i = 0; i < newas->as_nregions; i++) {
+			if (newas->as_regions[i].ar_file.vn != NULL) {
+				VOP_INCREF(newas->as_regions[i].ar_file.vn);
+			}
+		}
+	}
 	/*stack base + size*/
-	newas->as_stackbase;
-	newas->nStackPages;
+	newas->as_stackbase = old->as_stackbase;
+	newas->nStackPages  = old->nStackPages;
 	/*Heap base + size*/
-	newas->heapStart;
-	newas->heapEnd;
+	newas->heapStart    = old->heapStart;
+	newas->heapEnd      = old->heapEnd;
+	newas->as_noaccess  = old->as_noaccess;
+
+	result = as_copy_pages(old, newas);
+
+	/*The parent's pages may now be copy-on-write, so its writeable TLB
+	entries have to go. The parent is the process running here.*/
+	vm_asid_flush(old);
 
-	//*ret = newas;
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
+
+	*ret = newas;
 	return 0;
 }
 
 void
 as_destroy(struct addrspace *as)
 {
+	struct as_region *r;
+	unsigned i;
+
 	/*
 	 * Clean up as needed.
 	 */
 	 KASSERT(as != NULL);
+	 /*Shared file mappings are written back, as on munmap*/
+	 for (i = 0; i < as->as_nregions; i++) {
+		 r = &as->as_regions[i];
+		 if ((r->ar_flags & MAP_SHARED) && r->ar_file.vn != NULL) {
+			 vm_syncfile(r->ar_file.vn, r->ar_file.offset,
+				     r->ar_npages);
+		 }
+	 }
 	 /*Shoot down all TLB entries associated with this process's address space*/
 	 /*Then walk through PTE entries, manually change paddr and vaddr of the pages to 0
 	 Then do a kfree on the page's vaddr to mark the page clean in coremap*/
 
 	 deletePageTable(as);
-	 as->as_vbase1   = (vaddr_t)0;
-	 /*Region 2*/
-	 as->as_vbase2   = (vaddr_t)0;
+	 for (i = 0; i < as->as_nregions; i++) {
+		 if (as->as_regions[i].ar_file.vn != NULL) {
+			 VOP_DECREF(as->as_regions[i].ar_file.vn);
+		 }
+	 }
+	 kfree(as->as_regions);
+	 as->as_regions  = NULL;
+	 as->as_nregions = 0;
 	 /*stack base + size*/
 	 as->as_stackbase= (vaddr_t)0;
 	 /*Heap base + size*/
@@ -167,12 +388,9 @@ as_activate(void)
 	/*
 	 * Write this.
 	 */
-	 int spl;
-	 /*Flush all TLB entries, use the functio tlb_shootdown_all function*/
-	 spl = splhigh();
-	 vm_tlbshootdown_all();
-	 splx(spl);
-	 return;
+	 /*TLB entries are tagged with an address space ID, so switching only
+	 has to load ours*/
+	 vm_activate(as);
 }
 
 void
@@ -193,18 +411,43 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment.
+ *
+ * If V is not NULL, the first FILESIZE bytes of the segment are at
+ * OFFSET in V. The region holds a reference to V, and its pages are
+ * read in from there as they are first touched (see as_load_page).
+ *
+ * Segments come in address order, but the first page of one may be the
+ * last page of the one before. That page becomes a region of its own,
+ * with the rights of both, and is filled from both files.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
-		 int readable, int writeable, int executable)
+		 int readable, int writeable, int executable,
+		 struct vnode *v, off_t offset, size_t filesize)
 {
 	/*
 	 * Write this.
 	 */
-	 size_t npages;
+	 struct as_region r, page, *prev;
+	 vaddr_t regionEnd;
+	 unsigned i, next;
+	 bool shared;
+	 int result;
+
+	 /*Remember where the segment's data is before aligning it*/
+	 r.ar_file.vn       = filesize > 0 ? v : NULL;
+	 r.ar_file.offset   = offset;
+	 r.ar_file.vaddr    = vaddr;
+	 r.ar_file.filesize = filesize;
+	 r.ar_prot    = (readable ? PROT_READ : 0) |
+			(writeable ? PROT_WRITE : 0) |
+			(executable ? PROT_EXEC : 0);
+	 r.ar_maxprot = r.ar_prot;
+	 if (r.ar_prot == PROT_NONE) {
+		 as->as_noaccess = true;
+	 }
+	 r.ar_flags   = 0;
 	/*Pages calculation taken from dumbvm*/
  	/* Align the region. First, the base... */
  	memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
@@ -213,29 +456,73 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
  	/* ...and now the length. */
  	memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
 
- 	npages = memsize / PAGE_SIZE;
-	if (as->as_vbase1 == (vaddr_t)0) { //region 0 not yet allocated , do this first
-		as->perm_region1 = ((readable | writeable | executable) & 7) >> 3; //set permission in LSB 3 bits
-		as->as_vbase1 = vaddr;
-		as->as_npages1= npages;
-		/*Set heapStart and heapEnd */
-		return 0;
-		as->heapStart = ROUNDUP(as->as_vbase1 + (as->as_npages1 * PAGE_SIZE),PAGE_SIZE); //TODO : Discuss this
-		as->heapEnd   = as->heapStart;
+	r.ar_start  = vaddr;
+	r.ar_npages = memsize / PAGE_SIZE;
+	regionEnd = vaddr + memsize;
+	if (r.ar_npages == 0) {
 		return 0;
 	}
-	if (as->as_vbase2 == (vaddr_t)0) { //region 1 not yet allocated, do this now
-		as->perm_region2 = ((readable | writeable | executable) & 7) >> 3; //set permission in LSB 3 bits
-		as->as_vbase2 = vaddr;
-		as->as_npages2= npages;
-		/*Set heapStart and heapEnd */
-		as->heapStart = ROUNDUP(as->as_vbase2 + (as->as_npages2 * PAGE_SIZE),PAGE_SIZE); //TODO : Discuss this
-		as->heapEnd   = as->heapStart;
-		return 0;
+	if (regionEnd < vaddr || regionEnd > USERSPACETOP) {
+		return ENOEXEC;
+	}
+
+	i = as_region_index(as, vaddr);
+	shared = i < as->as_nregions && as->as_regions[i].ar_start < vaddr;
+	next = shared ? i + 1 : i;
+	if (next < as->as_nregions && as->as_regions[next].ar_start < regionEnd) {
+		return ENOEXEC;
+	}
+
+	if (shared) {
+		/*Our first page is the last page of the segment before*/
+		prev = &as->as_regions[i];
+		if (prev->ar_flags != 0 || as_region_end(prev) != vaddr + PAGE_SIZE ||
+		    (prev->ar_npages == 1 && r.ar_npages == 1)) {
+			return ENOEXEC;
+		}
+		if (prev->ar_npages > 1) {
+			page = *prev;
+			page.ar_start   = vaddr;
+			page.ar_npages  = 1;
+			page.ar_prot   |= r.ar_prot;
+			page.ar_maxprot = page.ar_prot;
+			page.ar_file.vn = NULL;
+			if (r.ar_npages == 1) {
+				page.ar_file = r.ar_file;
+			}
+			prev->ar_npages--;
+			result = as_region_insert(as, i + 1, &page);
+			if (result) {
+				as->as_regions[i].ar_npages++;
+				return result;
+			}
+			i += 2;
+		}
+		else {
+			prev->ar_prot   |= r.ar_prot;
+			prev->ar_maxprot = prev->ar_prot;
+			i++;
+		}
+		r.ar_start += PAGE_SIZE;
+		r.ar_npages--;
+	}
+	if (r.ar_npages > 0) {
+		result = as_region_insert(as, i, &r);
+		if (result) {
+			return result;
+		}
+	}
+
+	if (r.ar_file.vn != NULL) {
+		VOP_INCREF(r.ar_file.vn);
 	}
 
-	kprintf("More regions than supported !!! Panic");
-	return EACCES; //permission denied
+	/*The heap starts right after the highest region */
+	if (regionEnd > as->heapStart) {
+		as->heapStart = regionEnd;
+		as->heapEnd   = as->heapStart;
+	}
+	return 0;
 }
 
 int
@@ -244,18 +531,9 @@ as_prepare_load(struct addrspace *as)
 	/*
 	 * Write this.
 	 */
-	 /*Change the permission of each region to read-write*/
+	 /*Every region is treated as read-write until as_complete_load*/
 	 KASSERT(as != NULL);
-	 //TODO: Write assert statements here
-
-	 int oldPerm1 = ((as->perm_region1 << 3 ) & 6);
-	 int oldPerm2 = ((as->perm_region2 << 3) & 6); //store old permissions in MSB 3 bits
-
-	 as->perm_region1 = (PF_R | PF_W ) >> 3; //set new permissions as R-W
-	 as->perm_region2 = as->perm_region1 ;// R-W here too
-
-	 as->perm_region1 = (as->perm_region1 | oldPerm1); //save old permissions in MSB 3 bits
-	 as->perm_region2 = (as->perm_region2 | oldPerm2); //save old permissions in MSB 3 bits
+	 as->loading = true;
 
 	 return 0;
 }
@@ -266,13 +544,12 @@ as_complete_load(struct addrspace *as)
 	/*
 	 * Write this.
 	 */
-	 /*Change the permission of each region to original values; */
+	 /*Back to the original permissions. Pages loaded so far may sit in the
+	 TLB as writeable, so drop them.*/
 	KASSERT(as != NULL);
-	int oldPerm1 = ((as->perm_region1  & 7)>> 3);
-	int oldPerm2 = ((as->perm_region2  & 7)>> 3);
+	as->loading = false;
 
-	as->perm_region1 = oldPerm1;
-	as->perm_region2 = oldPerm2;
+	vm_asid_flush(as);
 
 	return 0;
 }
@@ -286,8 +563,445 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 
 	KASSERT(as != NULL);
 
+	/*The stack is demand paged, VM_STACKPAGES below USERSTACK*/
+	as->nStackPages  = VM_STACKPAGES;
+	as->as_stackbase = USERSTACK - VM_STACKPAGES * PAGE_SIZE;
+	KASSERT(as->as_stackbase >= as->heapEnd);
+
 	/* Initial user-level stack pointer */
 	*stackptr = USERSTACK;
 
 	return 0;
 }
+
+/*
+ * mmap() regions. They sit between the heap and the stack. A new one goes
+ * in the highest gap below the stack that is large enough, and the heap
+ * may grow up to the lowest one. Pages are demand paged like the rest:
+ * file pages are read in from the vnode, private ones into a frame of
+ * their own and shared ones through the page cache in vm.c.
+ */
+
+vaddr_t
+as_heaplimit(struct addrspace *as)
+{
+	unsigned i;
+
+	i = as_region_index(as, as->heapStart);
+	return i < as->as_nregions ? as->as_regions[i].ar_start :
+		as->as_stackbase;
+}
+
+int
+as_map(struct addrspace *as, size_t npages, int prot, int maxprot,
+       int flags, struct vnode *vn, off_t offset, vaddr_t *ret)
+{
+	struct as_region r;
+	vaddr_t top, end, bottom, len;
+	unsigned i;
+	int result;
+
+	KASSERT(as != NULL);
+	KASSERT(npages > 0);
+	KASSERT(flags != 0);
+
+	len = npages * PAGE_SIZE;
+	bottom = ROUNDUP(as->heapEnd, PAGE_SIZE);
+	top = as->as_stackbase;
+	for (i = as->as_nregions; i > 0; i--) {
+		if (as->as_regions[i - 1].ar_start < bottom) {
+			break;
+		}
+		end = as_region_end(&as->as_regions[i - 1]);
+		if (top - end >= len) {
+			break;
+		}
+		top = as->as_regions[i - 1].ar_start;
+	}
+	if (top < bottom || top - bottom < len) {
+		return ENOMEM;
+	}
+
+	r.ar_start   = top - len;
+	r.ar_npages  = npages;
+	r.ar_prot    = prot;
+	if (prot == PROT_NONE) {
+		as->as_noaccess = true;
+	}
+	r.ar_maxprot = maxprot;
+	r.ar_flags   = flags;
+	r.ar_file.vn       = vn;
+	r.ar_file.offset   = offset;
+	r.ar_file.vaddr    = r.ar_start;
+	r.ar_file.filesize = len;
+	result = as_region_insert(as, i, &r);
+	if (result) {
+		return result;
+	}
+	if (vn != NULL) {
+		VOP_INCREF(vn);
+	}
+
+	*ret = r.ar_start;
+	return 0;
+}
+
+/*
+ * Cut mapping I in two at VA, which lies inside it.
+ */
+static
+int
+as_split_region(struct addrspace *as, unsigned i, vaddr_t va)
+{
+	struct as_region upper;
+	size_t n;
+	int result;
+
+	KASSERT(as->as_regions[i].ar_flags != 0);
+	KASSERT(va > as->as_regions[i].ar_start &&
+		va < as_region_end(&as->as_regions[i]));
+
+	upper = as->as_regions[i];
+	n = (va - upper.ar_start) / PAGE_SIZE;
+	upper.ar_start   = va;
+	upper.ar_npages -= n;
+	upper.ar_file.offset  += (off_t)n * PAGE_SIZE;
+	upper.ar_file.vaddr    = va;
+	upper.ar_file.filesize = upper.ar_npages * PAGE_SIZE;
+	result = as_region_insert(as, i + 1, &upper);
+	if (result) {
+		return result;
+	}
+	as->as_regions[i].ar_npages = n;
+	as->as_regions[i].ar_file.filesize = n * PAGE_SIZE;
+	if (upper.ar_file.vn != NULL) {
+		VOP_INCREF(upper.ar_file.vn);
+	}
+	return 0;
+}
+
+/*
+ * Split the mappings that straddle either end of [VA, END), so that every
+ * mapping lies wholly inside the range or wholly outside it.
+ */
+static
+int
+as_split_range(struct addrspace *as, vaddr_t va, vaddr_t end)
+{
+	struct as_region *r;
+	int result;
+
+	r = as_find(as, va);
+	if (r != NULL && r->ar_flags != 0 && r->ar_start != va) {
+		result = as_split_region(as, r - as->as_regions, va);
+		if (result) {
+			return result;
+		}
+	}
+	r = as_find(as, end);
+	if (r != NULL && r->ar_flags != 0 && r->ar_start != end) {
+		return as_split_region(as, r - as->as_regions, end);
+	}
+	return 0;
+}
+
+int
+as_unmap(struct addrspace *as, vaddr_t va, size_t npages)
+{
+	struct as_region *r;
+	vaddr_t end;
+	unsigned i;
+	int result;
+
+	KASSERT(as != NULL);
+
+	end = va + npages * PAGE_SIZE;
+	result = as_split_range(as, va, end);
+	if (result) {
+		return result;
+	}
+
+	i = as_region_index(as, va);
+	while (i < as->as_nregions && as->as_regions[i].ar_start < end) {
+		r = &as->as_regions[i];
+		if (r->ar_flags == 0) {
+			i++;
+			continue;
+		}
+		/*Errors writing back cannot be reported by munmap; fsync first
+		to see them*/
+		if ((r->ar_flags & MAP_SHARED) && r->ar_file.vn != NULL) {
+			vm_syncfile(r->ar_file.vn, r->ar_file.offset, r->ar_npages);
+		}
+		vm_unmap(as, r->ar_start, r->ar_npages);
+		if (r->ar_file.vn != NULL) {
+			VOP_DECREF(r->ar_file.vn);
+		}
+		as_region_remove(as, i);
+	}
+	return 0;
+}
+
+int
+as_protect(struct addrspace *as, vaddr_t va, size_t npages, int prot)
+{
+	struct as_region *r;
+	vaddr_t end;
+	size_t covered;
+	bool revoked = false;
+	unsigned i, first;
+	int result;
+
+	KASSERT(as != NULL);
+
+	/*Every page has to be in a mapping the new rights are allowed on*/
+	end = va + npages * PAGE_SIZE;
+	first = as_region_index(as, va);
+	covered = 0;
+	for (i = first; i < as->as_nregions &&
+		     as->as_regions[i].ar_start < end; i++) {
+		r = &as->as_regions[i];
+		if (r->ar_flags == 0) {
+			return ENOMEM;
+		}
+		if ((prot & ~r->ar_maxprot) != 0) {
+			return EACCES;
+		}
+		covered += ((as_region_end(r) < end ? as_region_end(r) : end) -
+			    (r->ar_start > va ? r->ar_start : va)) / PAGE_SIZE;
+	}
+	if (covered != npages) {
+		return ENOMEM;
+	}
+
+	result = as_split_range(as, va, end);
+	if (result) {
+		return result;
+	}
+	for (i = as_region_index(as, va); i < as->as_nregions &&
+		     as->as_regions[i].ar_start < end; i++) {
+		r = &as->as_regions[i];
+		if ((r->ar_prot & ~prot) != 0) {
+			revoked = true;
+		}
+		r->ar_prot = prot;
+	}
+	if (prot == PROT_NONE) {
+		as->as_noaccess = true;
+	}
+	/*Pages may sit in the TLB with the rights just taken away*/
+	if (revoked) {
+		vm_asid_flush(as);
+	}
+	return 0;
+}
+
+bool
+as_shared_page(struct addrspace *as, vaddr_t va, struct vnode **vn,
+	       off_t *offset)
+{
+	struct as_region *r;
+
+	r = as_find(as, va);
+	if (r == NULL || (r->ar_flags & MAP_SHARED) == 0) {
+		return false;
+	}
+	*vn = r->ar_file.vn;
+	*offset = r->ar_file.offset + (off_t)(va - r->ar_start);
+	return true;
+}
+
+void
+as_getusage(struct addrspace *as, unsigned *rss, unsigned *maxrss,
+	    unsigned *swapouts)
+{
+	KASSERT(as != NULL);
+
+	/*Single words, so a stale value is the worst that can happen*/
+	*rss      = as->as_rss;
+	*maxrss   = as->as_maxrss;
+	*swapouts = as->as_swapouts;
+}
+
+/*
+ * Decide whether VA is a legal address in AS: inside a region, the heap,
+ * or the stack. Sets *WRITEABLE accordingly. This runs on every TLB miss,
+ * hence the binary search.
+ */
+int
+as_find_region(struct addrspace *as, vaddr_t va, bool *writeable)
+{
+	struct as_region *r;
+
+	KASSERT(as != NULL);
+
+	r = as_find(as, va);
+	if (r != NULL) {
+		if (r->ar_prot == PROT_NONE) {
+			return EFAULT;
+		}
+		*writeable = (r->ar_prot & PROT_WRITE) != 0 ||
+			(as->loading && r->ar_flags == 0);
+		return 0;
+	}
+	if ((va >= as->heapStart && va < as->heapEnd) ||
+	    (as->nStackPages > 0 && va >= as->as_stackbase &&
+	     va < USERSTACK)) {
+		*writeable = true;
+		return 0;
+	}
+	return EFAULT;
+}
+
+/*
+ * Copy the part of one backing file that overlaps user page VA into the
+ * page at kernel address KVA.
+ */
+static
+int
+as_load_backing(const struct as_backing *file, vaddr_t va, vaddr_t kva,
+		bool *loaded)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	int result;
+
+	if (file->vn == NULL) {
+		return 0;
+	}
+	start = va > file->vaddr ? va : file->vaddr;
+	end = va + PAGE_SIZE;
+	if (end > file->vaddr + file->filesize) {
+		end = file->vaddr + file->filesize;
+	}
+	if (start >= end) {
+		return 0;
+	}
+
+	uio_kinit(&iov, &ku, (void *)(kva + (start - va)), end - start,
+		  file->offset + (start - file->vaddr), UIO_READ);
+	result = VOP_READ(file->vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		kprintf("ELF: short read paging in 0x%lx - file truncated?\n",
+			(unsigned long)va);
+		return ENOEXEC;
+	}
+	*loaded = true;
+	return 0;
+}
+
+/*
+ * Whether any of the file data of FILE lands on user page VA.
+ */
+static
+bool
+as_backing_overlaps(const struct as_backing *file, vaddr_t va)
+{
+	return file->vn != NULL && file->vaddr < va + PAGE_SIZE &&
+		file->vaddr + file->filesize > va;
+}
+
+/*
+ * Read the page of file mapping R that backs user page VA into the page at
+ * kernel address KVA. Whatever lies past the end of the file stays zero.
+ */
+static
+int
+as_load_mapping(const struct as_region *r, vaddr_t va, vaddr_t kva,
+		bool *loaded)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, (void *)kva, PAGE_SIZE,
+		  r->ar_file.offset + (off_t)(va - r->ar_start), UIO_READ);
+	result = VOP_READ(r->ar_file.vn, &ku);
+	if (result) {
+		return result;
+	}
+	*loaded = ku.uio_resid < PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Demand loading of executables. The page has been zero-filled, which
+ * takes care of the BSS; fill in the file data of whichever segments
+ * overlap it (normally one, but a segment may share its first page with
+ * the one before, see as_define_region). Pages of file mappings come
+ * from their file.
+ */
+int
+as_load_page(struct addrspace *as, vaddr_t va, vaddr_t kva, bool *loaded)
+{
+	struct as_region *r;
+	unsigned i, j;
+	int result;
+
+	KASSERT(as != NULL);
+	*loaded = false;
+
+	i = as_region_index(as, va);
+	if (i == as->as_nregions || va < as->as_regions[i].ar_start) {
+		return 0;
+	}
+	r = &as->as_regions[i];
+	if (r->ar_flags != 0) {
+		return r->ar_file.vn == NULL ? 0 :
+			as_load_mapping(r, va, kva, loaded);
+	}
+
+	for (j = i > 0 ? i - 1 : 0; j <= i + 1 && j < as->as_nregions; j++) {
+		if (as->as_regions[j].ar_flags != 0) {
+			continue;
+		}
+		result = as_load_backing(&as->as_regions[j].ar_file, va, kva,
+					 loaded);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Decide whether user page VA of AS may come from the shared text cache:
+ * it must lie in a read-only segment backed by the executable and hold
+ * nothing from another segment. Sets *VN and *OFFSET to the file offset
+ * the page starts at, which is what the cache is keyed on.
+ */
+bool
+as_text_page(struct addrspace *as, vaddr_t va, struct vnode **vn,
+	     off_t *offset)
+{
+	const struct as_region *r;
+	unsigned i;
+
+	KASSERT(as != NULL);
+
+	if (as->loading) {
+		return false;
+	}
+	i = as_region_index(as, va);
+	if (i == as->as_nregions || va < as->as_regions[i].ar_start) {
+		return false;
+	}
+	r = &as->as_regions[i];
+	if (r->ar_flags != 0 || (r->ar_prot & PROT_WRITE) ||
+	    r->ar_file.vn == NULL) {
+		return false;
+	}
+	if ((i > 0 && as->as_regions[i - 1].ar_flags == 0 &&
+	     as_backing_overlaps(&as->as_regions[i - 1].ar_file, va)) ||
+	    (i + 1 < as->as_nregions && as->as_regions[i + 1].ar_flags == 0 &&
+	     as_backing_overlaps(&as->as_regions[i + 1].ar_file, va))) {
+		return false;
+	}
+	*vn = r->ar_file.vn;
+	*offset = r->ar_file.offset + ((off_t)va - (off_t)r->ar_file.vaddr);
+	return true;
+}
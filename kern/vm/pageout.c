@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pageout daemon.
+ *
+ * A kernel thread that keeps at least pageout_lowwater frames free so
+ * page faults rarely have to evict anything themselves. When an
+ * allocation leaves fewer free frames than that, it is woken and evicts
+ * pages until pageout_highwater are free. It then writes back up to
+ * pageout_batch dirty pages the clock is about to reach, so that they can
+ * later be evicted without waiting for a write.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <clock.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <thread.h>
+#include <vm.h>
+
+unsigned pageout_lowwater;
+unsigned pageout_highwater;
+unsigned pageout_batch;
+
+static struct semaphore *pageout_sem;
+static struct spinlock pageout_lock = SPINLOCK_INITIALIZER;
+static bool pageout_running;	/* woken and not yet done */
+
+/* Statistics, protected by pageout_lock */
+static unsigned pageout_wakeups;
+static unsigned pageout_freed;
+static unsigned pageout_cleaned;
+static struct timespec pageout_busytime;
+
+/*
+ * Wake the daemon if it is asleep. May be called from any context.
+ */
+void
+pageout_kick(void) {
+  bool wake = false;
+
+  spinlock_acquire(&pageout_lock);
+  if (pageout_sem != NULL && !pageout_running) {
+    pageout_running = true;
+    pageout_wakeups++;
+    wake = true;
+  }
+  spinlock_release(&pageout_lock);
+
+  if (wake) {
+    V(pageout_sem);
+  }
+}
+
+static
+void
+pageout_thread(void *data1, unsigned long data2) {
+  struct timespec start, end, diff;
+  unsigned freed, cleaned;
+
+  (void)data1;
+  (void)data2;
+
+  while (1) {
+    P(pageout_sem);
+    gettime(&start);
+
+    freed = 0;
+    while (coremap_free_pages() < pageout_highwater && vm_pageout_reclaim()) {
+      freed++;
+    }
+    for (cleaned = 0; cleaned < pageout_batch; cleaned++) {
+      if (!vm_pageout_clean()) {
+        break;
+      }
+    }
+
+    gettime(&end);
+    timespec_sub(&end, &start, &diff);
+
+    spinlock_acquire(&pageout_lock);
+    pageout_freed   += freed;
+    pageout_cleaned += cleaned;
+    pageout_busytime.tv_sec  += diff.tv_sec;
+    pageout_busytime.tv_nsec += diff.tv_nsec;
+    if (pageout_busytime.tv_nsec >= 1000000000) {
+      pageout_busytime.tv_nsec -= 1000000000;
+      pageout_busytime.tv_sec++;
+    }
+    pageout_running = false;
+    spinlock_release(&pageout_lock);
+  }
+}
+
+/*
+ * Start the daemon. Without swap there is nothing for it to do.
+ */
+void
+pageout_bootstrap(void) {
+  int result;
+
+  if (!swap_enabled()) {
+    return;
+  }
+
+  pageout_lowwater = coremap_total_pages() / PAGEOUT_LOWWATER_FRACTION;
+  if (pageout_lowwater < PAGEOUT_MIN_LOWWATER) {
+    pageout_lowwater = PAGEOUT_MIN_LOWWATER;
+  }
+  pageout_highwater = 2 * pageout_lowwater;
+  pageout_batch     = pageout_lowwater;
+
+  pageout_sem = sem_create("pageout", 0);
+  if (pageout_sem == NULL) {
+    panic("pageout_bootstrap: sem_create failed\n");
+  }
+  result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+  if (result) {
+    panic("pageout_bootstrap: thread_fork failed: %s\n", strerror(result));
+  }
+}
+
+/*
+ * Print tunables and write-back statistics for the pod menu command.
+ */
+void
+pageout_printstats(void) {
+  unsigned wakeups, freed, cleaned;
+  struct timespec busy;
+
+  spinlock_acquire(&pageout_lock);
+  wakeups = pageout_wakeups;
+  freed   = pageout_freed;
+  cleaned = pageout_cleaned;
+  busy    = pageout_busytime;
+  spinlock_release(&pageout_lock);
+
+  kprintf("pageout: low water %u, high water %u, batch %u, %u free now\n",
+          pageout_lowwater, pageout_highwater, pageout_batch,
+          coremap_free_pages());
+  kprintf("pageout: %u wakeups, %u pages freed, %u dirty pages cleaned\n",
+          wakeups, freed, cleaned);
+
+  if (busy.tv_sec > 0 || busy.tv_nsec > 0) {
+    kprintf("pageout: busy ");
+    timespec_printrate(&busy, cleaned, "write-backs");
+  }
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Two-level page tables for user address spaces.
+ *
+ * The directory and every second-level table are exactly one page, so
+ * they come out of the per-cpu page magazines via kmalloc.
+ */
+#include <types.h>
+#include <lib.h>
+#include <addrspace.h>
+#include <vm.h>
+
+pte_t **
+pgdir_create(void) {
+  pte_t **pgdir;
+
+  pgdir = kmalloc(PT_NENTRIES * sizeof(pte_t *));
+  if (pgdir == NULL) {
+    return NULL;
+  }
+  bzero(pgdir, PT_NENTRIES * sizeof(pte_t *));
+  return pgdir;
+}
+
+pte_t *
+pgdir_lookup(pte_t **pgdir, vaddr_t va, bool create) {
+  pte_t *table;
+
+  KASSERT(pgdir != NULL);
+  KASSERT(va < USERSPACETOP);
+
+  table = pgdir[PT_DIR_INDEX(va)];
+  if (table == NULL) {
+    if (!create) {
+      return NULL;
+    }
+    table = kmalloc(PT_NENTRIES * sizeof(pte_t));
+    if (table == NULL) {
+      return NULL;
+    }
+    bzero(table, PT_NENTRIES * sizeof(pte_t));
+    pgdir[PT_DIR_INDEX(va)] = table;
+  }
+  return &table[PT_TABLE_INDEX(va)];
+}
+
+void
+pgdir_destroy(pte_t **pgdir) {
+  int i;
+
+  KASSERT(pgdir != NULL);
+  for (i = 0; i < PT_NENTRIES; i++) {
+    if (pgdir[i] != NULL) {
+      kfree(pgdir[i]);
+    }
+  }
+  kfree(pgdir);
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Swap space on a raw lhd disk.
+ *
+ * Evicted user pages are written to page-sized slots of SWAP_DEVICE,
+ * which are handed out from a bitmap. Disk transfers are serialized by
+ * swap_lock. The evictor in vm.c holds it from the moment it unmaps a
+ * victim until the page is on disk, and page-in takes it as well, so a
+ * slot is never read back before it has been written.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+
+#define SWAP_DEVICE "lhd0raw:"
+
+struct lock *swap_lock;
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;
+static unsigned swap_nslots;
+static unsigned swap_nused;
+static struct spinlock swap_map_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Open the swap disk and size the slot bitmap to it. Without a disk the
+ * system runs as before and simply fails allocations when RAM is full.
+ */
+void
+swap_bootstrap(void) {
+  char path[sizeof(SWAP_DEVICE)];
+  struct stat st;
+  int result;
+
+  /* vfs_open destroys the string it's passed */
+  strcpy(path, SWAP_DEVICE);
+  result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+  if (result) {
+    kprintf("swap: %s: %s, running without swap\n", SWAP_DEVICE,
+            strerror(result));
+    swap_vnode = NULL;
+    return;
+  }
+
+  result = VOP_STAT(swap_vnode, &st);
+  if (result || st.st_size < PAGE_SIZE) {
+    kprintf("swap: %s has no usable space, running without swap\n",
+            SWAP_DEVICE);
+    goto fail;
+  }
+  swap_nslots = st.st_size / PAGE_SIZE;
+
+  swap_map = bitmap_create(swap_nslots);
+  if (swap_map == NULL) {
+    goto fail;
+  }
+  swap_lock = lock_create("swap");
+  if (swap_lock == NULL) {
+    bitmap_destroy(swap_map);
+    swap_map = NULL;
+    goto fail;
+  }
+
+  kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+  return;
+
+fail:
+  vfs_close(swap_vnode);
+  swap_vnode = NULL;
+}
+
+bool
+swap_enabled(void) {
+  return swap_lock != NULL;
+}
+
+int
+swap_slot_alloc(unsigned *slot) {
+  int result;
+
+  KASSERT(swap_enabled());
+  spinlock_acquire(&swap_map_lock);
+  result = bitmap_alloc(swap_map, slot);
+  if (result == 0) {
+    swap_nused++;
+  }
+  spinlock_release(&swap_map_lock);
+  return result;
+}
+
+void
+swap_slot_free(unsigned slot) {
+  KASSERT(swap_enabled() && slot < swap_nslots);
+  spinlock_acquire(&swap_map_lock);
+  bitmap_unmark(swap_map, slot);
+  swap_nused--;
+  spinlock_release(&swap_map_lock);
+}
+
+/*
+ * Move one page between the kernel buffer KBUF and swap slot SLOT.
+ */
+static
+int
+swap_io(void *kbuf, unsigned slot, enum uio_rw rw) {
+  struct iovec iov;
+  struct uio ku;
+  int result;
+
+  KASSERT(lock_do_i_hold(swap_lock));
+  KASSERT(slot < swap_nslots);
+
+  uio_kinit(&iov, &ku, kbuf, PAGE_SIZE,
+            (off_t)slot * PAGE_SIZE, rw);
+  if (rw == UIO_READ) {
+    result = VOP_READ(swap_vnode, &ku);
+  } else {
+    result = VOP_WRITE(swap_vnode, &ku);
+  }
+  if (result == 0 && ku.uio_resid != 0) {
+    result = EIO;
+  }
+  return result;
+}
+
+int
+swap_pageout(paddr_t pa, unsigned slot) {
+  return swap_io((void *)PADDR_TO_KVADDR(pa), slot, UIO_WRITE);
+}
+
+int
+swap_pagein(paddr_t pa, unsigned slot) {
+  return swap_io((void *)PADDR_TO_KVADDR(pa), slot, UIO_READ);
+}
+
+/*
+ * Give a forked child its own copy of a swapped-out page, bouncing it
+ * through a kernel page rather than bringing it back into user memory.
+ */
+int
+swap_dup(unsigned slot, unsigned *ret) {
+  vaddr_t bounce;
+  unsigned newslot;
+  int result;
+
+  bounce = alloc_kpages(1);
+  if (bounce == 0) {
+    return ENOMEM;
+  }
+  result = swap_slot_alloc(&newslot);
+  if (result) {
+    free_kpages(bounce);
+    return result;
+  }
+
+  lock_acquire(swap_lock);
+  result = swap_io((void *)bounce, slot, UIO_READ);
+  if (result == 0) {
+    result = swap_io((void *)bounce, newslot, UIO_WRITE);
+  }
+  lock_release(swap_lock);
+
+  free_kpages(bounce);
+  if (result) {
+    swap_slot_free(newslot);
+    return result;
+  }
+  *ret = newslot;
+  return 0;
+}
+
+void
+swap_getstats(unsigned *nslots, unsigned *nused) {
+  spinlock_acquire(&swap_map_lock);
+  *nslots = swap_nslots;
+  *nused  = swap_nused;
+  spinlock_release(&swap_map_lock);
+}
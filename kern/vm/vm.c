@@ -30,26 +30,166 @@
 
 /*Created : 26 March 2016*/
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <synch.h>
+#include <spl.h>
+#include <membar.h>
+#include <cpu.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
 #include <vm.h>
+#include <uio.h>
+#include <vnode.h>
+#include <kern/stat.h>
 #include <mips/tlb.h>
 
 //static bool vm_bootstrap_done = false;
 //struct lock* vm_lock; //no idea why, investigate later
 static unsigned long coremap_used_size;
+static unsigned long coremap_peak_size;
+/* Frames holding the coremap and tlbrefill_unref; never free, never counted
+   in coremap_used_size */
+static unsigned coremap_reserved;
 paddr_t lastpaddr, freeAddr, firstpaddr;
 
 int coremap_page_num;
 struct coremap_entry* coremap;
 //static bool firstuserboot = true;
 
+/* Heads of the buddy free lists, one per block order */
+static int free_head[CM_MAX_ORDER + 1];
+
+/* Pages parked in per-cpu magazines, and coremap lock statistics */
+static unsigned pagecache_pages;
+static unsigned cm_lock_acquires;
+static unsigned cm_lock_contended;
+
+bool vm_cow_enabled = true;
+bool vm_asid_enabled = true;
+bool vm_textshare_enabled = true;
+unsigned vm_tlbprefetch = VM_TLBPREFETCH;
+bool vm_fastrefill_enabled = true;
+bool vm_zeropool_enabled = true;
+
+/* Pool of pre-zeroed frames, linked through nextFree */
+static int zeropool_head = CM_NONE;
+static unsigned zeropool_pages;
+
+/* Text cache: hash chains of shared read-only executable frames */
+static int text_head[CM_TEXT_BUCKETS];
+
+/* Next coremap index the replacement clock looks at */
+static int clock_hand;
+
+/* Next coremap index the pageout daemon looks at for pages to clean */
+static int clean_hand;
+
+/* The cpus a TLB shootdown went to, and each one's ipi_tlbshootdown ticket */
+struct shootdown_wait {
+  uint32_t sw_cpus;
+  unsigned sw_ticket[MAXCPUS];
+};
+
+/* Fault counters, reported by vm_getfaultstats() */
+static struct vm_faultstats vmstats;
+static struct spinlock vmstats_lock = SPINLOCK_INITIALIZER;
+
 //extern paddr_t first_ram_phyAddr;
 /*
  * Wrap ram_stealmem in a spinlock.
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
+/* Coremap index of the page holding physical address PA */
+#define PADDR_TO_CMINDEX(pa) ((int)(((pa) - firstpaddr) / PAGE_SIZE))
+
+/*
+* Free list helpers. All of them expect stealmem_lock to be held.
+**/
+static
+void
+freelist_push(int index, int order) {
+  coremap[index].order    = order;
+  coremap[index].prevFree = CM_NONE;
+  coremap[index].nextFree = free_head[order];
+  if (free_head[order] != CM_NONE) {
+    coremap[free_head[order]].prevFree = index;
+  }
+  free_head[order] = index;
+}
+
+static
+void
+freelist_remove(int index) {
+  int order = coremap[index].order;
+
+  if (coremap[index].prevFree != CM_NONE) {
+    coremap[coremap[index].prevFree].nextFree = coremap[index].nextFree;
+  } else {
+    free_head[order] = coremap[index].nextFree;
+  }
+  if (coremap[index].nextFree != CM_NONE) {
+    coremap[coremap[index].nextFree].prevFree = coremap[index].prevFree;
+  }
+  coremap[index].order    = CM_NONE;
+  coremap[index].nextFree = CM_NONE;
+  coremap[index].prevFree = CM_NONE;
+}
+
+/*
+* Give the block of 2^order pages starting at index back to the free lists,
+* merging it with its buddy for as long as the buddy is also a free block of
+* the same order.
+**/
+static
+void
+buddy_free_block(int index, int order) {
+  int buddy;
+
+  while (order < CM_MAX_ORDER) {
+    buddy = index ^ (1 << order);
+    if (buddy + (1 << order) > coremap_page_num ||
+        coremap[buddy].state != CLEAN || coremap[buddy].order != order) {
+      break;
+    }
+    freelist_remove(buddy);
+    if (buddy < index) {
+      index = buddy;
+    }
+    order++;
+  }
+  freelist_push(index, order);
+}
+
+/*
+* Free an arbitrary run of npages pages by splitting it into the largest
+* naturally aligned power-of-two blocks it contains.
+**/
+static
+void
+buddy_free_range(int index, int npages) {
+  int order, i;
+
+  for (i = 0; i < npages; i++) {
+    coremap[index + i].state          = CLEAN;
+    coremap[index + i].allocPageCount = -1;
+    coremap[index + i].busy           = false;
+  }
+  while (npages > 0) {
+    order = 0;
+    while (order < CM_MAX_ORDER &&
+           (index & ((1 << (order + 1)) - 1)) == 0 &&
+           (1 << (order + 1)) <= npages) {
+      order++;
+    }
+    buddy_free_block(index, order);
+    index  += 1 << order;
+    npages -= 1 << order;
+  }
+}
+
 /*
 * Logic is to find the first free physical address from where we can start to initialize our coremap.
 * ram_getsize() returns total ram size, and ram_getfirstfree() returns first free physical address
@@ -72,150 +212,2010 @@ vm_bootstrap(void) {
 
   // Calculate and set the first free address after coremap is allocated
   freeAddr = firstpaddr + coremap_page_num * sizeof(struct coremap_entry);
+
+  // The fast TLB refill's referenced bytes go right after it
+  tlbrefill_unref = (uint8_t *)PADDR_TO_KVADDR(freeAddr);
+  memset(tlbrefill_unref, 1, lastpaddr / PAGE_SIZE);
+  freeAddr += lastpaddr / PAGE_SIZE;
 	freeAddr = ROUNDUP(freeAddr, PAGE_SIZE);
 
   // Allocate memory to coremap
 	coremap  = (struct coremap_entry *)PADDR_TO_KVADDR(firstpaddr);
 	coremap_size = ROUNDUP( (freeAddr - firstpaddr),PAGE_SIZE) / PAGE_SIZE;
 
-  // Initiliase each page status in coremap
+  // Initiliase each page status in coremap; everything starts out in use
 	for(i =0 ; i < coremap_page_num; i++ ) {
-		if (i < coremap_size) {
-			coremap[i].state = DIRTY;
-		} else {
-			coremap[i].state = CLEAN;
-		}
 		temp = firstpaddr + (PAGE_SIZE * i);
-    coremap[i].phyAddr= temp;
+    coremap[i].as             = NULL;
+    coremap[i].state          = DIRTY;
+    coremap[i].order          = CM_NONE;
+    coremap[i].nextFree       = CM_NONE;
+    coremap[i].prevFree       = CM_NONE;
+    coremap[i].phyAddr        = temp;
     coremap[i].allocPageCount = -1;
-    coremap[i].va = PADDR_TO_KVADDR(temp);
+    coremap[i].refCount       = 0;
+    coremap[i].busy           = false;
+    coremap[i].referenced     = false;
+    coremap[i].dirty          = false;
+    coremap[i].swapSlot       = CM_NOSLOT;
+    coremap[i].shared         = false;
+    coremap[i].fileVnode      = NULL;
+    coremap[i].fileOffset     = 0;
+    coremap[i].nextCached     = CM_NONE;
+    coremap[i].va             = PADDR_TO_KVADDR(temp);
 	}
+  for (i = 0; i < CM_TEXT_BUCKETS; i++) {
+    text_head[i] = CM_NONE;
+  }
+  coremap[0].allocPageCount = coremap_size;
+
+  // Hand every page after the coremap itself to the buddy free lists
+  for (i = 0; i <= CM_MAX_ORDER; i++) {
+    free_head[i] = CM_NONE;
+  }
+  buddy_free_range(coremap_size, coremap_page_num - coremap_size);
+  coremap_reserved = coremap_size;
+
   // Set coremap used size to 0
   coremap_used_size = 0;
 }
 
 /*
-*
+* Frames on the buddy free lists; parked pages count as allocated. Exact
+* with the coremap lock held; a hint without it.
 **/
-paddr_t
-getppages(unsigned long npages)
-{
-   spinlock_acquire(&stealmem_lock);
-   paddr_t addr;
-   int nPageTemp = (int)npages;
-   int i, block_count , page_block_start = 0;
-
-   block_count = nPageTemp;
-   for(i=0; i < coremap_page_num; i++) {
-     if (coremap[i].state == CLEAN) {
-       block_count--;
-       if (block_count == 0) {
-         break; //
-       }
-     } else {
-       block_count = nPageTemp;
+static
+unsigned
+frames_free(void) {
+  return coremap_page_num - coremap_reserved - coremap_used_size / PAGE_SIZE;
+}
+
+/*
+* Take the global coremap lock, counting how often somebody else already
+* had it. The counters are only updated with the lock held.
+**/
+static
+void
+coremap_lock(void) {
+  bool busy;
+
+  busy = spinlock_data_get(&stealmem_lock.splk_lock) != 0;
+  spinlock_acquire(&stealmem_lock);
+  cm_lock_acquires++;
+  if (busy) {
+    cm_lock_contended++;
+  }
+}
+
+static
+void
+coremap_unlock(void) {
+  spinlock_release(&stealmem_lock);
+}
+
+/*
+* Bytes allocated as far as the buddy lists are concerned but really free:
+* pages parked in magazines or the zero pool. Caller holds the coremap lock.
+**/
+static
+unsigned long
+coremap_parked_bytes(void) {
+  return (pagecache_pages + zeropool_pages) * PAGE_SIZE;
+}
+
+static
+void
+coremap_update_peak(void) {
+  if (coremap_used_size - coremap_parked_bytes() > coremap_peak_size) {
+    coremap_peak_size = coremap_used_size - coremap_parked_bytes();
+  }
+}
+
+/*
+* Allocate npages physically contiguous pages from the buddy lists and
+* return the coremap index of the first one, or CM_NONE. The request is
+* rounded up to the next block order, and the unused tail of the block is
+* returned to the free lists straight away so that exactly npages pages are
+* accounted for. Caller holds the coremap lock.
+**/
+static
+int
+buddy_alloc(int nPageTemp) {
+   int order, o, index;
+
+   order = 0;
+   while ((1 << order) < nPageTemp) {
+     order++;
+   }
+   if (order > CM_MAX_ORDER) {
+     return CM_NONE;
+   }
+   for (o = order; o <= CM_MAX_ORDER; o++) {
+     if (free_head[o] != CM_NONE) {
+       break;
      }
    }
-
-   if (i == coremap_page_num) { //no free pages
-     spinlock_release(&stealmem_lock);
-     return 0;
+   if (o > CM_MAX_ORDER) { //no free block large enough
+     return CM_NONE;
    }
-   page_block_start = i - nPageTemp + 1;
 
-   for(i = 0; i < nPageTemp; i++) {
-     coremap[i + page_block_start].state = DIRTY;
+   index = free_head[o];
+   freelist_remove(index);
+   // Split the block, handing the upper halves back until it fits
+   while (o > order) {
+     o--;
+     freelist_push(index + (1 << o), o);
+   }
+   for (o = 0; o < nPageTemp; o++) {
+     coremap[index + o].state          = DIRTY;
+     coremap[index + o].allocPageCount = -1;
+   }
+   coremap[index].allocPageCount = nPageTemp;
+   if (nPageTemp < (1 << order)) {
+     buddy_free_range(index + nPageTemp, (1 << order) - nPageTemp);
    }
-   addr = coremap[page_block_start].phyAddr;
-   coremap[page_block_start].allocPageCount = nPageTemp;
 
    coremap_used_size = coremap_used_size + (nPageTemp * PAGE_SIZE);
-   spinlock_release(&stealmem_lock);
-   return addr;
+   coremap_update_peak();
+   return index;
 }
 
-/*kmalloc-routines*/
-vaddr_t
-alloc_kpages(unsigned npages) {
+/*
+* Give back the allocation starting at coremap index. Caller holds the
+* coremap lock.
+**/
+static
+void
+buddy_release(int index) {
+  int pgCount = coremap[index].allocPageCount;
 
-  paddr_t pa = getppages(npages);
-	if (pa == 0) {
-		return 0;
-	}else{
-	  return PADDR_TO_KVADDR(pa);
+  KASSERT(coremap[index].state == DIRTY && pgCount > 0);
+  buddy_free_range(index, pgCount);
+
+  // Remove the memory of removed pages from counter
+  coremap_used_size = coremap_used_size - (pgCount * PAGE_SIZE);
+}
+
+/*
+* Wake the pageout daemon once free memory drops below its low-water mark.
+* The count is read without the lock; it is only a hint.
+**/
+static
+void
+pageout_check(void) {
+  if (frames_free() < pageout_lowwater) {
+    pageout_kick();
   }
 }
 
+paddr_t
+getppages(unsigned long npages)
+{
+   int index;
+
+   if (npages == 0) {
+     return 0;
+   }
+   coremap_lock();
+   index = buddy_alloc((int)npages);
+   coremap_unlock();
+   pageout_check();
+   if (index == CM_NONE) {
+     return 0;
+   }
+   return coremap[index].phyAddr;
+}
+
+/*
+* Release an allocation made by getppages(). The coremap index is computed
+* from the physical address, so no search is needed.
+**/
+void
+freeppages(paddr_t paddr) {
+  KASSERT(paddr >= firstpaddr && paddr < lastpaddr);
+  KASSERT((paddr & PAGE_FRAME) == paddr);
+
+  coremap_lock();
+  buddy_release(PADDR_TO_CMINDEX(paddr));
+  coremap_unlock();
+}
+
+/*
+* Per-cpu page magazines.
+*
+* Single-page allocations and frees go to curcpu's magazine with interrupts
+* off and no lock at all. Only when the magazine runs empty (or full) do we
+* take the coremap lock, and then move CPU_PAGECACHE_BATCH pages at once.
+* Pages sitting in a magazine are allocated as far as the buddy lists are
+* concerned but are not counted by coremap_used_bytes().
+**/
+static
 void
-free_kpages(vaddr_t addr) {
-  spinlock_acquire(&stealmem_lock);
-  int i;
-  int pgCount = 0;
+pagecache_refill(struct cpu *c) {
+  int index;
 
-  for(i = 0; i < coremap_page_num; i++){
-    if(coremap[i].va == addr){
-      pgCount = coremap[i].allocPageCount;
+  coremap_lock();
+  while (c->c_npagecache < CPU_PAGECACHE_BATCH) {
+    index = buddy_alloc(1);
+    if (index == CM_NONE) {
       break;
     }
+    c->c_pagecache[c->c_npagecache++] = coremap[index].phyAddr;
+    pagecache_pages++;
   }
+  coremap_unlock();
+  pageout_check();
+}
 
-  int j;
-  for( j = 0; j < pgCount; j++){
-    coremap[i+j].allocPageCount = -1;
-    coremap[i+j].state = CLEAN;
+static
+void
+pagecache_drain(struct cpu *c, unsigned keep) {
+  paddr_t pa;
+
+  coremap_lock();
+  while (c->c_npagecache > keep) {
+    pa = c->c_pagecache[--c->c_npagecache];
+    buddy_release(PADDR_TO_CMINDEX(pa));
+    pagecache_pages--;
   }
+  coremap_unlock();
+}
 
-  // Remove the memory of removed pages from counter
-  coremap_used_size = coremap_used_size - (pgCount * PAGE_SIZE);
+static
+paddr_t
+pagecache_get(void) {
+  struct cpu *c;
+  paddr_t pa = 0;
+  int spl;
 
-  spinlock_release(&stealmem_lock);
+  spl = splhigh();
+  c = curcpu->c_self;
+  if (c->c_npagecache == 0) {
+    c->c_pagecache_misses++;
+    pagecache_refill(c);
+  } else {
+    c->c_pagecache_hits++;
+  }
+  if (c->c_npagecache > 0) {
+    pa = c->c_pagecache[--c->c_npagecache];
+  }
+  splx(spl);
+  return pa;
 }
 
-int
-vm_fault(int faulttype, vaddr_t faultaddress) {
-  (void)faulttype;
-  (void)faultaddress;
-
+static
+void
+pagecache_put(paddr_t pa) {
+  struct cpu *c;
+  int spl;
 
-  return 0;
+  spl = splhigh();
+  c = curcpu->c_self;
+  if (c->c_npagecache == CPU_PAGECACHE_MAX) {
+    c->c_pagecache_drains++;
+    pagecache_drain(c, CPU_PAGECACHE_MAX - CPU_PAGECACHE_BATCH);
+  } else {
+    c->c_pagecache_frees++;
+  }
+  c->c_pagecache[c->c_npagecache++] = pa;
+  splx(spl);
 }
 
+/*
+* Hand everything in curcpu's magazine back to the coremap, e.g. before
+* retrying a multi-page allocation that failed.
+**/
+static
 void
-vm_tlbshootdown_all(void)
-{
-	//panic("dumbvm tried to do tlb shootdown?!\n");
-  int i;
-    for (i=0; i<NUM_TLB; i++) {
-  		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+pagecache_flush(void) {
+  int spl;
+
+  spl = splhigh();
+  pagecache_drain(curcpu->c_self, 0);
+  splx(spl);
+}
+
+/*
+* Zero pool.
+*
+* Cpus with nothing to run zero free frames ahead of time (vm_idle_zero,
+* called from the idle loop in thread_switch) and park them here, so a
+* zero-fill fault can take one already cleared instead of zeroing it on
+* the fault path. The pool is a stack linked through the coremap's
+* nextFree, which pool pages, being allocated, do not otherwise use. Like
+* magazine pages they are not counted by coremap_used_bytes(), and they
+* are given up whenever memory runs short. Protected by the coremap lock.
+**/
+static
+paddr_t
+zeropool_get(void) {
+  int index;
+
+  coremap_lock();
+  index = zeropool_head;
+  if (index != CM_NONE) {
+    zeropool_head = coremap[index].nextFree;
+    zeropool_pages--;
+    coremap_update_peak();
+  }
+  coremap_unlock();
+
+  spinlock_acquire(&vmstats_lock);
+  if (index != CM_NONE) {
+    vmstats.vfs_zeropoolhits++;
+  } else {
+    vmstats.vfs_zeropoolmisses++;
   }
+  spinlock_release(&vmstats_lock);
+  return index == CM_NONE ? 0 : coremap[index].phyAddr;
 }
 
+/*
+* Hand the whole pool back to the buddy lists, e.g. before retrying an
+* allocation that failed.
+**/
+static
 void
-vm_tlbshootdown(const struct tlbshootdown *ts)
-{
-	(void)ts;
-	panic("dumbvm tried to do tlb shootdown?!\n");
+zeropool_drain(void) {
+  int index;
+
+  coremap_lock();
+  while (zeropool_head != CM_NONE) {
+    index = zeropool_head;
+    zeropool_head = coremap[index].nextFree;
+    zeropool_pages--;
+    buddy_release(index);
+  }
+  coremap_unlock();
+}
+
+/*
+* Zero one free frame into the pool if it is short and memory is not, and
+* return whether there was anything to do. Runs in thread_switch's idle
+* loop, so it never sleeps and never wakes the pageout daemon; it just
+* leaves pageout_lowwater frames, plus the pool's worth, alone. The bzero
+* runs at spl0 so timer and unidle IPIs are not held off for a whole page;
+* as with cpu_idle, c_isidle makes an interrupt's thread_yield a no-op.
+**/
+bool
+vm_idle_zero(void) {
+  int index, spl;
+
+  if (!vm_zeropool_enabled || coremap == NULL ||
+      zeropool_pages >= VM_ZEROPOOL_PAGES ||
+      frames_free() < pageout_lowwater + VM_ZEROPOOL_PAGES) {
+    return false;
+  }
+
+  coremap_lock();
+  index = buddy_alloc(1);
+  coremap_unlock();
+  if (index == CM_NONE) {
+    return false;
+  }
+  spl = spl0();
+  bzero((void *)PADDR_TO_KVADDR(coremap[index].phyAddr), PAGE_SIZE);
+  splx(spl);
+
+  coremap_lock();
+  coremap[index].nextFree = zeropool_head;
+  zeropool_head = index;
+  zeropool_pages++;
+  coremap_unlock();
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_zeropoolfills++;
+  spinlock_release(&vmstats_lock);
+  return true;
+}
+
+/*
+* Common allocation path for kernel and user pages. Single pages come from
+* the per-cpu magazine once there is a curcpu to hang it off. When memory
+* runs out the zero pool is given up before anyone resorts to eviction.
+**/
+static
+paddr_t
+page_alloc(unsigned npages) {
+  paddr_t pa;
+
+  if (npages == 1 && CURCPU_EXISTS()) {
+    pa = pagecache_get();
+  } else {
+    pa = getppages(npages);
+    if (pa == 0 && npages > 1 && CURCPU_EXISTS()) {
+      pagecache_flush();
+      pa = getppages(npages);
+    }
+  }
+  if (pa == 0 && zeropool_pages > 0) {
+    zeropool_drain();
+    pa = getppages(npages);
+  }
+  return pa;
 }
 
-/*Shoot down a TLB entry based on given virtual address*/
+static
 void
-tlb_shootdown_page_table_entry(vaddr_t va) {
-  int i;
-  uint32_t ehi, elo;
-  KASSERT((va & PAGE_FRAME ) == va); //assert that va is a valid virtual address
-  spinlock_acquire(&stealmem_lock);
-  for(i=0; i < NUM_TLB; i++) {
-    tlb_read(&ehi, &elo, i);
-    if (ehi  == va) {
-      tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+page_free(paddr_t pa) {
+  KASSERT(pa >= firstpaddr && pa < lastpaddr);
+  if (coremap[PADDR_TO_CMINDEX(pa)].allocPageCount == 1 && CURCPU_EXISTS()) {
+    pagecache_put(pa);
+  } else {
+    freeppages(pa);
+  }
+}
+
+/*
+* Page cache.
+*
+* Read-only pages of executables are shared by every address space running
+* the same file, and pages of MAP_SHARED file mappings by every address
+* space mapping the same file. Such a frame is hashed on the vnode and file
+* offset it was read from and is mapped by refCount PTEs, like a
+* copy-on-write frame. The two kinds are told apart by the shared bit and
+* never match each other, since a text page may hold zero-fill or another
+* segment where the file has other data. A frame leaves the cache when the
+* last mapping goes (upage_unref) or when it is evicted, which it can only
+* be while a single address space maps it and, if shared, once it has been
+* written back. Frames are only entered once they have been read in, so a
+* frame in the cache is never busy. All of this is under the coremap lock.
+**/
+static
+unsigned
+text_hash(struct vnode *vn, off_t offset) {
+  return ((uintptr_t)vn / sizeof(void *) + (unsigned)(offset / PAGE_SIZE)) %
+         CM_TEXT_BUCKETS;
+}
+
+static
+int
+text_lookup(struct vnode *vn, off_t offset, bool shared) {
+  int index;
+
+  for (index = text_head[text_hash(vn, offset)]; index != CM_NONE;
+       index = coremap[index].nextCached) {
+    if (coremap[index].fileVnode == vn &&
+        coremap[index].fileOffset == offset &&
+        coremap[index].shared == shared) {
       break;
     }
+  }
+  return index;
+}
 
+static
+void
+text_insert(int index, struct vnode *vn, off_t offset, bool shared) {
+  unsigned bucket = text_hash(vn, offset);
+
+  KASSERT(coremap[index].fileVnode == NULL);
+  coremap[index].shared     = shared;
+  coremap[index].fileVnode  = vn;
+  coremap[index].fileOffset = offset;
+  coremap[index].nextCached = text_head[bucket];
+  text_head[bucket] = index;
+}
+
+static
+void
+text_remove(int index) {
+  int *prev;
+
+  prev = &text_head[text_hash(coremap[index].fileVnode,
+                              coremap[index].fileOffset)];
+  while (*prev != index) {
+    KASSERT(*prev != CM_NONE);
+    prev = &coremap[*prev].nextCached;
   }
-  spinlock_release(&stealmem_lock);
+  *prev = coremap[index].nextCached;
+  coremap[index].nextCached = CM_NONE;
+  coremap[index].fileVnode  = NULL;
 }
 
-unsigned
-int coremap_used_bytes(void) {
-  return coremap_used_size;
+/*
+* Write the page at pa back to offset in vn, stopping at the end of the
+* file: a mapping never makes the file grow.
+**/
+static
+int
+vm_filewrite(struct vnode *vn, off_t offset, paddr_t pa) {
+  struct iovec iov;
+  struct uio ku;
+  struct stat st;
+  size_t len;
+  int result;
+
+  result = VOP_STAT(vn, &st);
+  if (result) {
+    return result;
+  }
+  if (offset >= st.st_size) {
+    return 0;
+  }
+  len = st.st_size - offset < PAGE_SIZE ? st.st_size - offset : PAGE_SIZE;
+  uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), len, offset, UIO_WRITE);
+  return VOP_WRITE(vn, &ku);
+}
+
+/*
+* Eviction.
+*
+* When RAM is full, user pages are pushed out to swap (see swap.c). A
+* victim is any user frame mapped by exactly one address space that is not
+* busy. Frames are busy while they are being evicted and from allocation
+* until they are entered in a PTE, so the evictor never sees a frame whose
+* PTE is not in place yet.
+*
+* The victim's PTE is switched to its swap slot under the coremap lock, so
+* a later fault pages it back in; vm_fault loads the TLB under the same
+* lock, and the page is shot down on every cpu before it is written out.
+*
+* Victims are chosen by a clock over the coremap using per-frame
+* referenced and dirty bits, which MIPS does not keep for us:
+*
+*   - referenced is set whenever vm_fault loads the page into the TLB. The
+*     clock clears it and drops the page from the local TLB, so the next
+*     use faults and sets it again. Entries on other cpus are left alone,
+*     so a page only used there may look unreferenced. Misses taken by the
+*     fast refill in exception-mips1.S leave a mark in tlbrefill_unref
+*     instead, which page_referenced folds in.
+*
+*   - dirty means the frame differs from its copy in swap. Clean pages are
+*     loaded read-only, so the first write comes back as VM_FAULT_READONLY
+*     and sets it. A page read back from swap keeps its slot, so while it
+*     stays clean it can be evicted without writing it again, and a page
+*     that was zero-filled and never written is simply dropped.
+*
+* Pages of MAP_SHARED mappings never go to swap, where the other mappers
+* could not find them. A file page is dirty when it differs from the file;
+* it is only evicted once written back (see vm_pageout_clean) and is then
+* read from the file again. Shared anonymous pages stay resident.
+**/
+static
+bool
+page_referenced(int index) {
+  unsigned frame;
+
+  frame = coremap[index].phyAddr / PAGE_SIZE;
+  if (tlbrefill_unref[frame] == 0) {
+    coremap[index].referenced = true;
+    tlbrefill_unref[frame] = 1;
+  }
+  return coremap[index].referenced;
+}
+
+static
+bool
+page_evictable(int index) {
+  return coremap[index].state == DIRTY && coremap[index].as != NULL &&
+         coremap[index].refCount == 1 && !coremap[index].busy &&
+         (!coremap[index].shared ||
+          (coremap[index].fileVnode != NULL && !coremap[index].dirty));
+}
+
+/*
+* A page the pageout daemon may write back ahead of the clock: one it
+* could evict but for being dirty.
+**/
+static
+bool
+page_cleanable(int index) {
+  return coremap[index].state == DIRTY && coremap[index].as != NULL &&
+         coremap[index].refCount == 1 && !coremap[index].busy &&
+         coremap[index].dirty && !page_referenced(index) &&
+         (!coremap[index].shared || coremap[index].fileVnode != NULL);
+}
+
+/*
+* Eviction sleeps on the swap disk, so only try it from thread context with
+* no spinlocks held, and not from within the evictor itself.
+**/
+static
+bool
+vm_can_evict(void) {
+  return swap_enabled() && CURCPU_EXISTS() && !curthread->t_in_interrupt &&
+         curcpu->c_spinlocks == 0 && !lock_do_i_hold(swap_lock);
+}
+
+/*
+* Invalidate the entry for va tagged with asid in this cpu's TLB. The probe
+* clobbers entryhi, so the current ID is put back afterwards.
+**/
+static
+void
+tlb_invalidate(vaddr_t va, unsigned asid) {
+  int spl, index;
+
+  spl = splhigh();
+  index = tlb_probe(va | asid << TLBHI_PIDSHIFT, 0);
+  if (index >= 0) {
+    tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+  }
+  tlb_setpid(curcpu->c_asid_cur);
+  splx(spl);
+}
+
+/*
+* Invalidate va of as in this cpu's TLB, if as has a live ID here.
+**/
+static
+void
+tlb_invalidate_as(struct addrspace *as, vaddr_t va) {
+  struct as_asid *a;
+  int spl;
+
+  spl = splhigh();
+  a = &as->as_asids[curcpu->c_number];
+  if (a->gen == curcpu->c_asid_gen) {
+    tlb_invalidate(va, a->asid);
+  }
+  splx(spl);
+}
+
+/*
+* Start invalidating va of as on every cpu where as still has a live ID:
+* here right away, on the others by IPI. Cpus as never ran on, or whose
+* TLB was flushed since, are left alone. Called with the coremap lock held,
+* since as may be destroyed as soon as it is dropped; the caller then waits
+* for the IPIs with tlb_shootdown_wait(). Interrupts stay off while the IPIs
+* go out so that we cannot migrate to a cpu we have already skipped.
+* Any number of shootdowns may be outstanding at once: each target counts
+* the batches it handles, flush-everything ones included, and a wait is
+* over once every target has moved past the ticket it handed out.
+**/
+static
+void
+tlb_shootdown_send(struct addrspace *as, vaddr_t va,
+                   struct shootdown_wait *sw) {
+  struct tlbshootdown ts;
+  struct as_asid *a;
+  struct cpu *c;
+  unsigned i, sent;
+  int spl;
+
+  ts.ts_vaddr = va;
+  sw->sw_cpus = 0;
+  sent = 0;
+
+  spl = splhigh();
+  tlb_invalidate_as(as, va);
+  for (i = 0; i < num_cpus; i++) {
+    c = cpu_getnum(i);
+    a = &as->as_asids[c->c_number];
+    if (c == curcpu->c_self || a->gen != c->c_asid_gen) {
+      continue;
+    }
+    ts.ts_asid = a->asid;
+    sw->sw_ticket[i] = ipi_tlbshootdown(c, &ts);
+    sw->sw_cpus |= (uint32_t)1 << i;
+    sent++;
+  }
+  splx(spl);
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_shootdowns += sent;
+  spinlock_release(&vmstats_lock);
+}
+
+static
+void
+tlb_shootdown_wait(struct shootdown_wait *sw) {
+  unsigned i;
+
+  for (i = 0; i < num_cpus; i++) {
+    if ((sw->sw_cpus & ((uint32_t)1 << i)) == 0) {
+      continue;
+    }
+    while (!ipi_tlbshootdown_done(cpu_getnum(i), sw->sw_ticket[i])) {
+      /* spin; interrupts are on between checks */
+    }
+  }
+}
+
+/*
+* Enhanced second chance: the first sweep looks for a page that is neither
+* referenced nor dirty; the second settles for a dirty one and clears the
+* referenced bits it passes. Two more sweeps of the same are then bound
+* to find something if anything is evictable at all. Caller holds the
+* coremap lock.
+**/
+static
+int
+clock_select(void) {
+  unsigned cleared = 0;
+  int pass, i, index;
+
+  for (pass = 0; pass < 4; pass++) {
+    for (i = 0; i < coremap_page_num; i++) {
+      index = clock_hand;
+      clock_hand = (clock_hand + 1) % coremap_page_num;
+      if (!page_evictable(index)) {
+        continue;
+      }
+      if (!page_referenced(index) &&
+          (pass % 2 == 1 || !coremap[index].dirty)) {
+        break;
+      }
+      if (pass % 2 == 1 && coremap[index].referenced) {
+        coremap[index].referenced = false;
+        tlb_invalidate_as(coremap[index].as, coremap[index].va);
+        cleared++;
+      }
+    }
+    if (i < coremap_page_num) {
+      break;
+    }
+  }
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_refclears += cleared;
+  spinlock_release(&vmstats_lock);
+  return pass < 4 ? index : CM_NONE;
+}
+
+/*
+* Evict one user page and return its frame, still allocated and marked
+* busy, or 0 if there is nothing to evict or no swap left. Only dirty
+* pages are written out.
+**/
+static
+paddr_t
+page_evict(void) {
+  struct addrspace *as;
+  struct shootdown_wait sw;
+  vaddr_t va;
+  paddr_t pa;
+  pte_t *pte;
+  unsigned slot;
+  bool dirty;
+  int index, result;
+
+  lock_acquire(swap_lock);
+  coremap_lock();
+  index = clock_select();
+  if (index == CM_NONE) {
+    coremap_unlock();
+    lock_release(swap_lock);
+    return 0;
+  }
+
+  as    = coremap[index].as;
+  va    = coremap[index].va;
+  pa    = coremap[index].phyAddr;
+  slot  = coremap[index].swapSlot;
+  dirty = coremap[index].dirty;
+  if (dirty && slot == CM_NOSLOT && swap_slot_alloc(&slot)) {
+    /* Swap is full */
+    coremap_unlock();
+    lock_release(swap_lock);
+    return 0;
+  }
+
+  pte = pgdir_lookup(as->pgdir, va, false);
+  KASSERT(pte != NULL && (*pte & PTE_VALID) && (*pte & PTE_FRAME) == pa);
+  /* A clean page with no copy in swap is just dropped; it is zero-filled
+     or read from the executable again when next touched */
+  *pte = slot == CM_NOSLOT ? 0 : PTE_MKSWAP(slot);
+  as->as_rss--;
+  if (dirty) {
+    as->as_swapouts++;
+  }
+  coremap[index].busy       = true;
+  coremap[index].as         = NULL;
+  coremap[index].va         = PADDR_TO_KVADDR(pa);
+  coremap[index].refCount   = 0;
+  coremap[index].swapSlot   = CM_NOSLOT;
+  coremap[index].dirty      = false;
+  coremap[index].referenced = false;
+  if (coremap[index].fileVnode != NULL) {
+    text_remove(index);
+  }
+  tlb_shootdown_send(as, va, &sw);
+  coremap_unlock();
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_evictions++;
+  if (dirty) {
+    vmstats.vfs_pageouts++;
+  }
+  spinlock_release(&vmstats_lock);
+
+  tlb_shootdown_wait(&sw);
+
+  if (dirty) {
+    result = swap_pageout(pa, slot);
+    if (result) {
+      panic("swap: writing page out to slot %u: %s\n", slot,
+            strerror(result));
+    }
+  }
+  lock_release(swap_lock);
+  return pa;
+}
+
+/*
+* Make room for a kernel allocation that found memory full by evicting
+* user pages. A single page is taken straight from the evictor; for larger
+* blocks the evicted frames go back to the buddy lists until a large enough
+* run has coalesced, giving up after a bounded number of evictions.
+**/
+static
+paddr_t
+page_reclaim(unsigned npages) {
+  paddr_t pa;
+  unsigned i;
+
+  for (i = 0; i < npages * CM_RECLAIM_TRIES; i++) {
+    pa = page_evict();
+    if (pa == 0) {
+      return 0;
+    }
+    coremap[PADDR_TO_CMINDEX(pa)].busy = false;
+    if (npages == 1) {
+      return pa;
+    }
+    freeppages(pa);
+    pa = getppages(npages);
+    if (pa != 0) {
+      return pa;
+    }
+  }
+  return 0;
+}
+
+/*kmalloc-routines*/
+vaddr_t
+alloc_kpages(unsigned npages) {
+
+  paddr_t pa = page_alloc(npages);
+  if (pa == 0 && vm_can_evict()) {
+    pa = page_reclaim(npages);
+  }
+	if (pa == 0) {
+		return 0;
+	}else{
+	  return PADDR_TO_KVADDR(pa);
+  }
+}
+
+void
+free_kpages(vaddr_t addr) {
+  KASSERT(addr >= MIPS_KSEG0 && addr < MIPS_KSEG1);
+  page_free(addr - MIPS_KSEG0);
+}
+
+/*
+* Allocate a frame for the user page at va in as, evicting another page if
+* memory is full, and record the owner in the coremap. The frame is
+* zero-filled unless the caller is about to overwrite it anyway. It comes
+* back busy; upage_map() enters it in a PTE and makes it evictable.
+**/
+static
+paddr_t
+upage_alloc(struct addrspace *as, vaddr_t va, bool zero) {
+  paddr_t pa;
+  int index;
+
+  KASSERT(as != NULL);
+  pa = zero && vm_zeropool_enabled ? zeropool_get() : 0;
+  if (pa != 0) {
+    zero = false;
+  } else {
+    pa = page_alloc(1);
+  }
+  if (pa == 0 && vm_can_evict()) {
+    pa = page_evict();
+  }
+  if (pa == 0) {
+    return 0;
+  }
+  if (zero) {
+    bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+  }
+
+  /* busy has to be visible before as makes the frame look like a victim */
+  index = PADDR_TO_CMINDEX(pa);
+  coremap[index].busy       = true;
+  membar_store_store();
+  coremap[index].va         = va;
+  coremap[index].refCount   = 1;
+  coremap[index].referenced = true;
+  coremap[index].dirty      = false;
+  coremap[index].swapSlot   = CM_NOSLOT;
+  coremap[index].shared     = false;
+  coremap[index].as         = as;
+  return pa;
+}
+
+/*
+* One more valid PTE in as. Caller holds the coremap lock.
+**/
+static
+void
+rss_add(struct addrspace *as) {
+  as->as_rss++;
+  if (as->as_rss > as->as_maxrss) {
+    as->as_maxrss = as->as_rss;
+  }
+}
+
+/*
+* Charge a fault to the current process: major if it had to read the page
+* in, minor otherwise.
+**/
+static
+void
+vm_chargefault(bool major) {
+  if (major) {
+    curproc->p_vmstats.pv_majflt++;
+  } else {
+    curproc->p_vmstats.pv_minflt++;
+  }
+}
+
+/*
+* Enter a frame from upage_alloc() in its PTE. Caller holds the coremap
+* lock.
+**/
+static
+void
+upage_map(pte_t *pte, paddr_t pa, bool dirty) {
+  int index = PADDR_TO_CMINDEX(pa);
+
+  if ((*pte & PTE_VALID) == 0) {
+    rss_add(coremap[index].as);
+  }
+  *pte = pa | PTE_VALID;
+  coremap[index].dirty = dirty;
+  coremap[index].busy  = false;
+}
+
+/*
+* Give back a frame from upage_alloc() that never got mapped.
+**/
+static
+void
+upage_discard(paddr_t pa) {
+  int index = PADDR_TO_CMINDEX(pa);
+
+  coremap_lock();
+  coremap[index].as       = NULL;
+  coremap[index].va       = PADDR_TO_KVADDR(pa);
+  coremap[index].refCount = 0;
+  coremap[index].busy     = false;
+  coremap_unlock();
+  page_free(pa);
+}
+
+/*
+* Drop one reference to a user frame; returns true if it was the last one
+* and the caller should free the frame once the coremap lock is released.
+* If AS owned the frame but others still map it, the owner is no longer
+* known and the frame stays resident until a copy-on-write fault claims
+* it. AS is NULL when dropping a pin rather than a mapping. Caller holds
+* the coremap lock.
+**/
+static
+bool
+upage_unref(struct addrspace *as, int index) {
+  KASSERT(coremap[index].refCount > 0);
+  coremap[index].refCount--;
+  if (coremap[index].refCount == 0) {
+    if (coremap[index].fileVnode != NULL) {
+      text_remove(index);
+    }
+    if (coremap[index].swapSlot != CM_NOSLOT) {
+      swap_slot_free(coremap[index].swapSlot);
+      coremap[index].swapSlot = CM_NOSLOT;
+    }
+    coremap[index].as = NULL;
+    coremap[index].va = PADDR_TO_KVADDR(coremap[index].phyAddr);
+    return true;
+  }
+  if (as != NULL && coremap[index].as == as) {
+    coremap[index].as = NULL;
+  }
+  return false;
+}
+
+/*
+* Release whatever backs the PTE of a page of AS that is going away: a
+* reference to its frame (and with the last one the frame's copy in
+* swap), or its swap slot.
+**/
+void
+vm_freepte(struct addrspace *as, pte_t *pte) {
+  pte_t entry;
+  bool freed = false;
+
+  coremap_lock();
+  entry = *pte;
+  *pte = 0;
+  if (entry & PTE_VALID) {
+    as->as_rss--;
+    freed = upage_unref(as, PADDR_TO_CMINDEX(entry & PTE_FRAME));
+  }
+  coremap_unlock();
+
+  if (entry & PTE_SWAPPED) {
+    swap_slot_free(PTE_SWAPSLOT(entry));
+  } else if (freed) {
+    page_free(entry & PTE_FRAME);
+  }
+}
+
+/*
+* Duplicate the page at va for a forked child. With vm_cow_enabled a
+* resident frame is shared and both PTEs become copy-on-write; otherwise
+* it is copied right away. A swapped-out page gets a copy of its slot. A
+* page of a MAP_SHARED mapping (shared) is simply mapped by both.
+**/
+int
+vm_copypte(struct addrspace *newas, vaddr_t va, pte_t *oldpte,
+           pte_t *newpte, bool shared) {
+  pte_t entry;
+  paddr_t pa;
+  unsigned slot;
+  int index = CM_NONE;
+  int result;
+
+  coremap_lock();
+  entry = *oldpte;
+  /* MAP_SHARED pages are never in swap (see page_evictable) */
+  KASSERT(!shared || (entry & PTE_SWAPPED) == 0);
+  if (entry & PTE_VALID) {
+    /* Either a new sharer, or a pin so the frame stays put while copied */
+    index = PADDR_TO_CMINDEX(entry & PTE_FRAME);
+    coremap[index].refCount++;
+    if (shared) {
+      /* Parent and child keep writing to the one frame */
+      *newpte = entry;
+      rss_add(newas);
+      coremap_unlock();
+      return 0;
+    }
+    /* Shared text is never written, so it is shared even without COW */
+    if (vm_cow_enabled || coremap[index].fileVnode != NULL) {
+      *oldpte = entry | PTE_COW;
+      *newpte = entry | PTE_COW;
+      rss_add(newas);
+      coremap_unlock();
+      return 0;
+    }
+  }
+  coremap_unlock();
+
+  if (entry & PTE_SWAPPED) {
+    result = swap_dup(PTE_SWAPSLOT(entry), &slot);
+    if (result) {
+      return result;
+    }
+    *newpte = PTE_MKSWAP(slot);
+    return 0;
+  }
+
+  KASSERT(index != CM_NONE);
+  pa = upage_alloc(newas, va, false);
+  if (pa != 0) {
+    memmove((void *)PADDR_TO_KVADDR(pa),
+            (const void *)PADDR_TO_KVADDR(entry & PTE_FRAME), PAGE_SIZE);
+  }
+
+  coremap_lock();
+  if (pa != 0) {
+    upage_map(newpte, pa, true);
+  }
+  /* The parent still maps the frame, so this is never the last reference */
+  upage_unref(NULL, index);
+  coremap_unlock();
+
+  return pa == 0 ? ENOMEM : 0;
+}
+
+/*
+* Pageout daemon hooks (see pageout.c).
+*
+* vm_pageout_reclaim evicts one page and hands its frame back to the buddy
+* lists. It returns false if nothing could be evicted.
+**/
+bool
+vm_pageout_reclaim(void) {
+  paddr_t pa;
+
+  pa = page_evict();
+  if (pa == 0) {
+    return false;
+  }
+  coremap[PADDR_TO_CMINDEX(pa)].busy = false;
+  freeppages(pa);
+  return true;
+}
+
+/*
+* Write back one dirty page that the clock is about to reach, so that
+* evicting it later costs no write. The page stays mapped. It is marked
+* clean and shot down from the TLBs before the write, so a store racing
+* with the write faults and marks it dirty again. An extra reference pins
+* the frame meanwhile. Returns false if there was nothing to clean.
+**/
+bool
+vm_pageout_clean(void) {
+  struct shootdown_wait sw;
+  struct vnode *vn = NULL;
+  off_t offset = 0;
+  vaddr_t va;
+  paddr_t pa;
+  unsigned slot = CM_NOSLOT;
+  int i, index, result;
+  bool freed;
+
+  lock_acquire(swap_lock);
+  coremap_lock();
+  index = CM_NONE;
+  for (i = 0; i < coremap_page_num && index == CM_NONE; i++) {
+    if (page_cleanable(clean_hand)) {
+      index = clean_hand;
+    }
+    clean_hand = (clean_hand + 1) % coremap_page_num;
+  }
+  if (index == CM_NONE) {
+    coremap_unlock();
+    lock_release(swap_lock);
+    return false;
+  }
+
+  if (coremap[index].shared) {
+    /* A shared file page goes back to its file; hold on to the vnode in
+       case the mapping goes away during the write */
+    vn = coremap[index].fileVnode;
+    offset = coremap[index].fileOffset;
+    VOP_INCREF(vn);
+  } else {
+    slot = coremap[index].swapSlot;
+  }
+  if (vn == NULL && slot == CM_NOSLOT) {
+    if (swap_slot_alloc(&slot)) {
+      coremap_unlock();
+      lock_release(swap_lock);
+      return false;
+    }
+    coremap[index].swapSlot = slot;
+  }
+  va = coremap[index].va;
+  pa = coremap[index].phyAddr;
+  coremap[index].dirty = false;
+  coremap[index].refCount++;
+  tlb_shootdown_send(coremap[index].as, va, &sw);
+  coremap_unlock();
+
+  tlb_shootdown_wait(&sw);
+
+  if (vn != NULL) {
+    lock_release(swap_lock);
+    result = vm_filewrite(vn, offset, pa);
+    VOP_DECREF(vn);
+  } else {
+    result = swap_pageout(pa, slot);
+    lock_release(swap_lock);
+    if (result) {
+      panic("swap: writing page out to slot %u: %s\n", slot,
+            strerror(result));
+    }
+  }
+
+  coremap_lock();
+  if (result) {
+    /* Keep the page until it can be written */
+    coremap[index].dirty = true;
+  }
+  freed = upage_unref(NULL, index);
+  coremap_unlock();
+  if (freed) {
+    page_free(pa);
+  }
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_precleans++;
+  spinlock_release(&vmstats_lock);
+  return true;
+}
+
+/*
+* Write back the dirty pages of MAP_SHARED mappings of vn that cover npages
+* pages from file offset offset, for munmap, fsync and exit. A page that a
+* single address space maps is marked clean and shot down first, as in
+* vm_pageout_clean; one mapped by several stays dirty, since a store
+* through any of them could race with the write. The caller holds a
+* reference to vn. Returns the first error; the page then stays dirty.
+**/
+int
+vm_syncfile(struct vnode *vn, off_t offset, unsigned npages) {
+  struct shootdown_wait sw;
+  paddr_t pa;
+  unsigned i;
+  int index, result, error = 0;
+  bool freed;
+
+  for (i = 0; i < npages; i++, offset += PAGE_SIZE) {
+    coremap_lock();
+    index = text_lookup(vn, offset, true);
+    if (index == CM_NONE || !coremap[index].dirty) {
+      coremap_unlock();
+      continue;
+    }
+    sw.sw_cpus = 0;
+    if (coremap[index].refCount == 1 && coremap[index].as != NULL) {
+      coremap[index].dirty = false;
+      tlb_shootdown_send(coremap[index].as, coremap[index].va, &sw);
+    }
+    coremap[index].refCount++;
+    pa = coremap[index].phyAddr;
+    coremap_unlock();
+
+    tlb_shootdown_wait(&sw);
+    result = vm_filewrite(vn, offset, pa);
+
+    coremap_lock();
+    if (result) {
+      coremap[index].dirty = true;
+      if (error == 0) {
+        error = result;
+      }
+    }
+    freed = upage_unref(NULL, index);
+    coremap_unlock();
+    if (freed) {
+      page_free(pa);
+    }
+  }
+  return error;
+}
+
+/*
+* Print allocator statistics for the cms menu command.
+**/
+void
+coremap_printstats(void) {
+  struct cpu *c;
+  unsigned i, used, nfree, cached, acquires, contended, nslots, nswapped;
+  unsigned textframes = 0, textmaps = 0;
+
+  coremap_lock();
+  used      = coremap_used_size / PAGE_SIZE;
+  nfree     = frames_free();
+  cached    = pagecache_pages;
+  acquires  = cm_lock_acquires;
+  contended = cm_lock_contended;
+  for (i = 0; i < (unsigned)coremap_page_num; i++) {
+    if (coremap[i].fileVnode != NULL) {
+      textframes++;
+      textmaps += coremap[i].refCount;
+    }
+  }
+  coremap_unlock();
+
+  kprintf("coremap: %d pages, %u for the coremap, %u allocated, "
+          "%u in per-cpu caches, %u free\n", coremap_page_num,
+          coremap_reserved, used - cached, cached, nfree);
+  kprintf("coremap lock: %u acquisitions, %u contended\n",
+          acquires, contended);
+  kprintf("zero pool: %u of %u pages\n", zeropool_pages, VM_ZEROPOOL_PAGES);
+  kprintf("text cache: %u pages mapped %u times, %u KB saved\n",
+          textframes, textmaps, (textmaps - textframes) * PAGE_SIZE / 1024);
+  if (swap_enabled()) {
+    swap_getstats(&nslots, &nswapped);
+    kprintf("swap: %u of %u pages in use\n", nswapped, nslots);
+  }
+  for (i = 0; i < num_cpus; i++) {
+    c = cpu_getnum(i);
+    kprintf("cpu%u: %2u cached, %u hits, %u misses, %u frees, %u drains\n",
+            c->c_number, c->c_npagecache, c->c_pagecache_hits,
+            c->c_pagecache_misses, c->c_pagecache_frees,
+            c->c_pagecache_drains);
+  }
+}
+
+/*
+* Print per-cpu TLB refill counts for the vms menu command: misses handled
+* by the fast refill against translations loaded by vm_fault.
+**/
+void
+vm_printtlbstats(void) {
+  struct cpu *c;
+  unsigned i;
+
+  for (i = 0; i < num_cpus; i++) {
+    c = cpu_getnum(i);
+    kprintf("cpu%u: %u fast refills, %u slow (%u prefetched), %u flushes\n",
+            c->c_number, tlbrefill[c->c_number].tr_fast, c->c_tlb_refills,
+            c->c_tlb_prefetches, c->c_tlb_flushes);
+  }
+}
+
+/*
+* TLB address space IDs. Each cpu hands out the IDs 1 to NUM_TLBPID-1 in
+* turn to the address spaces that run on it and records them in their
+* as_asids. When it runs out it flushes its TLB and starts a new
+* generation, which makes every ID handed out before stale. A context
+* switch then only loads the ID into entryhi, and an address space finds
+* its entries still in the TLB when it comes back. With vm_asid_enabled
+* off every activation starts a new generation, which is the same as
+* flushing the TLB on every switch.
+**/
+static
+void
+asid_newgen(struct cpu *c) {
+  vm_tlbshootdown_all();
+  c->c_asid_gen++;
+  if (c->c_asid_gen == 0) {
+    /* Generation 0 means "no ID" in as_asids */
+    c->c_asid_gen = 1;
+  }
+  c->c_asid_next = 1;
+  c->c_tlb_flushes++;
+}
+
+void
+vm_activate(struct addrspace *as) {
+  struct as_asid *a;
+  struct cpu *c;
+  int spl;
+
+  spl = splhigh();
+  c = curcpu->c_self;
+  a = &as->as_asids[c->c_number];
+  if (!vm_asid_enabled) {
+    asid_newgen(c);
+  }
+  if (a->gen != c->c_asid_gen) {
+    if (c->c_asid_next == NUM_TLBPID) {
+      asid_newgen(c);
+    }
+    a->asid = c->c_asid_next++;
+    a->gen  = c->c_asid_gen;
+  }
+  c->c_asid_cur = a->asid;
+  tlb_setpid(a->asid);
+  tlbrefill[c->c_number].tr_pgdir =
+    vm_fastrefill_enabled && !as->as_noaccess ? as->pgdir : NULL;
+  splx(spl);
+}
+
+/*
+* Forgetting an address space's entries costs nothing but its IDs: once
+* they are stale, the old entries can never match again. Only the process
+* running as can change it, so no other cpu is using those IDs right now.
+**/
+void
+vm_asid_flush(struct addrspace *as) {
+  unsigned i;
+  int spl;
+
+  spl = splhigh();
+  for (i = 0; i < MAXCPUS; i++) {
+    as->as_asids[i].gen = 0;
+  }
+  if (as == proc_getas()) {
+    vm_activate(as);
+  }
+  splx(spl);
+}
+
+/*
+* Drop the TLB entries of as, which is being destroyed and will not run
+* again. n is the number of its resident pages, and vas holds their
+* addresses if there are no more than TLBSHOOTDOWN_MAX. Those few are
+* invalidated with one probe each; otherwise a single pass over the TLB
+* drops everything tagged with the ID of as. Its IDs on other cpus are just
+* made stale, since nothing can match those entries any more.
+**/
+void
+vm_asid_release(struct addrspace *as, const vaddr_t *vas, unsigned n) {
+  struct as_asid *a;
+  uint32_t ehi, elo;
+  unsigned i;
+  int spl;
+
+  spl = splhigh();
+  a = &as->as_asids[curcpu->c_number];
+  if (a->gen == curcpu->c_asid_gen) {
+    if (n <= TLBSHOOTDOWN_MAX) {
+      for (i = 0; i < n; i++) {
+        tlb_invalidate(vas[i], a->asid);
+      }
+    } else {
+      for (i = 0; i < NUM_TLB; i++) {
+        tlb_read(&ehi, &elo, i);
+        if ((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT == a->asid) {
+          tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+        }
+      }
+    }
+    if (curcpu->c_asid_cur == a->asid) {
+      curcpu->c_asid_cur = 0;
+    }
+    tlb_setpid(curcpu->c_asid_cur);
+  }
+  for (i = 0; i < MAXCPUS; i++) {
+    as->as_asids[i].gen = 0;
+    /* The page table is about to be freed */
+    if (tlbrefill[i].tr_pgdir == as->pgdir) {
+      tlbrefill[i].tr_pgdir = NULL;
+    }
+  }
+  splx(spl);
+}
+
+/*
+* as, the current address space, has changed a translation and already
+* replaced its entry here. Rather than interrupting the cpus it ran on
+* before, make its IDs there stale, so it starts afresh if it goes back.
+**/
+static
+void
+asid_drop_remote(struct addrspace *as) {
+  unsigned i;
+  int spl;
+
+  spl = splhigh();
+  for (i = 0; i < MAXCPUS; i++) {
+    if (i != curcpu->c_number) {
+      as->as_asids[i].gen = 0;
+    }
+  }
+  splx(spl);
+}
+
+/*
+* Unmap npages pages of the current address space as from va on, e.g. when
+* its heap shrinks: drop their TLB entries and release whatever backs them.
+* Stretches without a second-level table are skipped whole.
+**/
+void
+vm_unmap(struct addrspace *as, vaddr_t va, unsigned npages) {
+  vaddr_t end;
+  pte_t *pte;
+  bool unmapped = false;
+
+  end = va + npages * PAGE_SIZE;
+  while (va < end) {
+    pte = pgdir_lookup(as->pgdir, va, false);
+    if (pte == NULL) {
+      va = PT_VADDR(PT_DIR_INDEX(va) + 1, 0);
+      continue;
+    }
+    if (*pte != 0) {
+      tlb_invalidate_as(as, va);
+      vm_freepte(as, pte);
+      unmapped = true;
+    }
+    va += PAGE_SIZE;
+  }
+  if (unmapped) {
+    asid_drop_remote(as);
+  }
+}
+
+/*
+* Load a translation of the current address space into the TLB, replacing
+* any entry for the same page.
+**/
+static
+void
+tlb_load(vaddr_t va, paddr_t pa, bool writeable) {
+  uint32_t ehi, elo;
+  int spl, index;
+
+  elo = pa | TLBLO_VALID;
+  if (writeable) {
+    elo |= TLBLO_DIRTY;
+  }
+
+  spl = splhigh();
+  ehi = va | curcpu->c_asid_cur << TLBHI_PIDSHIFT;
+  curcpu->c_tlb_refills++;
+  index = tlb_probe(ehi, 0);
+  if (index >= 0) {
+    tlb_write(ehi, elo, index);
+  } else {
+    tlb_random(ehi, elo);
+  }
+  splx(spl);
+}
+
+/*
+* After a miss on va, whose PTE is pte, load the other resident pages of its
+* aligned block of vm_tlbprefetch pages, with the rights a miss on each
+* would give it. The block lies inside one page table, so its PTEs sit next
+* to pte. Caller holds the coremap lock.
+**/
+static
+void
+tlb_prefetch(struct addrspace *as, vaddr_t va, pte_t *pte) {
+  vaddr_t base, nva;
+  pte_t entry;
+  bool writeable;
+  unsigned i;
+  int index;
+
+  if (vm_tlbprefetch <= 1) {
+    return;
+  }
+  base = va & ~(vaddr_t)(vm_tlbprefetch * PAGE_SIZE - 1);
+  pte -= (va - base) / PAGE_SIZE;
+  for (i = 0; i < vm_tlbprefetch; i++) {
+    nva = base + i * PAGE_SIZE;
+    entry = pte[i];
+    if (nva == va || (entry & PTE_VALID) == 0) {
+      continue;
+    }
+    if (as_find_region(as, nva, &writeable)) {
+      continue;
+    }
+    index = PADDR_TO_CMINDEX(entry & PTE_FRAME);
+    coremap[index].referenced = true;
+    tlb_load(nva, entry & PTE_FRAME,
+             writeable && coremap[index].dirty && (entry & PTE_COW) == 0);
+    curcpu->c_tlb_prefetches++;
+  }
+}
+
+/*
+* Map a frame from the page cache at va of as; caller holds the coremap
+* lock.
+**/
+static
+void
+vm_cachemap(struct addrspace *as, int index, vaddr_t va, pte_t *pte,
+            bool dirty, bool writeable) {
+  rss_add(as);
+  coremap[index].refCount++;
+  coremap[index].referenced = true;
+  if (dirty) {
+    coremap[index].dirty = true;
+  }
+  *pte = coremap[index].phyAddr | PTE_VALID;
+  tlb_load(va, coremap[index].phyAddr, writeable && coremap[index].dirty);
+}
+
+/*
+* First touch of a page that other address spaces may map as well: a
+* read-only page of an executable, or a page of a MAP_SHARED mapping. For
+* a file page, map the copy in the page cache, or read the page in and
+* enter it there. Another process may read in the same page meanwhile, in
+* which case its copy wins and ours is thrown away. Shared anonymous
+* pages (vn NULL) are simply zero-filled.
+**/
+static
+int
+vm_cachedpage(struct addrspace *as, vaddr_t va, pte_t *pte, struct vnode *vn,
+              off_t offset, bool shared, bool dirty, bool writeable) {
+  paddr_t pa;
+  bool loaded = false;
+  int index = CM_NONE, result;
+
+  if (vn != NULL) {
+    coremap_lock();
+    index = text_lookup(vn, offset, shared);
+    if (index != CM_NONE) {
+      vm_cachemap(as, index, va, pte, dirty, writeable);
+      coremap_unlock();
+
+      spinlock_acquire(&vmstats_lock);
+      vmstats.vfs_textshared++;
+      spinlock_release(&vmstats_lock);
+      vm_chargefault(false);
+      return 0;
+    }
+    coremap_unlock();
+  }
+
+  pa = upage_alloc(as, va, true);
+  if (pa == 0) {
+    return ENOMEM;
+  }
+  if (vn != NULL) {
+    result = as_load_page(as, va, PADDR_TO_KVADDR(pa), &loaded);
+    if (result) {
+      upage_discard(pa);
+      return result;
+    }
+  }
+
+  coremap_lock();
+  KASSERT(*pte == 0);
+  if (vn != NULL) {
+    index = text_lookup(vn, offset, shared);
+  }
+  if (index != CM_NONE) {
+    vm_cachemap(as, index, va, pte, dirty, writeable);
+  } else {
+    if (vn != NULL) {
+      text_insert(PADDR_TO_CMINDEX(pa), vn, offset, shared);
+    }
+    coremap[PADDR_TO_CMINDEX(pa)].shared = shared;
+    upage_map(pte, pa, dirty);
+    tlb_load(va, pa, writeable && dirty);
+  }
+  coremap_unlock();
+
+  if (index != CM_NONE) {
+    upage_discard(pa);
+  }
+  spinlock_acquire(&vmstats_lock);
+  if (index != CM_NONE) {
+    vmstats.vfs_textshared++;
+  } else if (loaded) {
+    vmstats.vfs_filepages++;
+  } else {
+    vmstats.vfs_zerofills++;
+  }
+  spinlock_release(&vmstats_lock);
+  vm_chargefault(loaded);
+  return 0;
+}
+
+/*
+* Bring in the page behind a PTE that is not resident: on first touch a
+* zero-filled frame with any data from the executable read into it, or
+* the contents of its swap slot. The frame keeps the slot, so it can be
+* evicted again without a write while it stays clean; a clean page with no
+* slot is dropped on eviction and simply read or zero-filled again.
+**/
+static
+int
+vm_pagein(struct addrspace *as, vaddr_t va, pte_t *pte, pte_t entry,
+          bool dirty, bool writeable) {
+  struct vnode *vn;
+  off_t offset;
+  paddr_t pa;
+  bool loaded = false;
+  int result;
+
+  if (entry == 0 && as_shared_page(as, va, &vn, &offset)) {
+    return vm_cachedpage(as, va, pte, vn, offset, true, dirty, writeable);
+  }
+  if (entry == 0 && vm_textshare_enabled &&
+      as_text_page(as, va, &vn, &offset)) {
+    return vm_cachedpage(as, va, pte, vn, offset, false, false, false);
+  }
+
+  pa = upage_alloc(as, va, (entry & PTE_SWAPPED) == 0);
+  if (pa == 0) {
+    return ENOMEM;
+  }
+  if (entry & PTE_SWAPPED) {
+    lock_acquire(swap_lock);
+    result = swap_pagein(pa, PTE_SWAPSLOT(entry));
+    lock_release(swap_lock);
+    if (result) {
+      upage_discard(pa);
+      return result;
+    }
+  } else {
+    result = as_load_page(as, va, PADDR_TO_KVADDR(pa), &loaded);
+    if (result) {
+      upage_discard(pa);
+      return result;
+    }
+  }
+
+  /* Only the owner changes PTEs that are not resident */
+  coremap_lock();
+  KASSERT(*pte == entry);
+  if (entry & PTE_SWAPPED) {
+    coremap[PADDR_TO_CMINDEX(pa)].swapSlot = PTE_SWAPSLOT(entry);
+  }
+  upage_map(pte, pa, dirty);
+  tlb_load(va, pa, writeable && dirty);
+  coremap_unlock();
+
+  spinlock_acquire(&vmstats_lock);
+  if (entry & PTE_SWAPPED) {
+    vmstats.vfs_pageins++;
+  } else if (loaded) {
+    vmstats.vfs_filepages++;
+  } else {
+    vmstats.vfs_zerofills++;
+  }
+  spinlock_release(&vmstats_lock);
+  if (entry & PTE_SWAPPED) {
+    curproc->p_vmstats.pv_swapins++;
+  }
+  vm_chargefault(loaded || (entry & PTE_SWAPPED) != 0);
+  return 0;
+}
+
+/*
+* Fault in every page of npages pages from va of as, the current address
+* space, that has not been touched yet. Used on shared anonymous mappings
+* before a fork, so that parent and child find the same frames.
+**/
+int
+vm_populate(struct addrspace *as, vaddr_t va, unsigned npages) {
+  pte_t *pte;
+  pte_t entry;
+  int result;
+
+  KASSERT(as == proc_getas());
+  for (; npages > 0; npages--, va += PAGE_SIZE) {
+    pte = pgdir_lookup(as->pgdir, va, true);
+    if (pte == NULL) {
+      return ENOMEM;
+    }
+    coremap_lock();
+    entry = *pte;
+    coremap_unlock();
+    if (entry == 0) {
+      result = vm_pagein(as, va, pte, entry, false, false);
+      if (result) {
+        return result;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+* Make a private copy of a shared copy-on-write page before it is written.
+* The caller has pinned the old frame with an extra reference.
+**/
+static
+int
+vm_cow_copy(struct addrspace *as, vaddr_t va, pte_t *pte, pte_t entry,
+            bool writeable) {
+  paddr_t oldpa, newpa;
+  int oldindex;
+  bool freed;
+
+  oldpa = entry & PTE_FRAME;
+  oldindex = PADDR_TO_CMINDEX(oldpa);
+
+  newpa = upage_alloc(as, va, false);
+  if (newpa != 0) {
+    memmove((void *)PADDR_TO_KVADDR(newpa),
+            (const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+  }
+
+  coremap_lock();
+  if (newpa != 0) {
+    KASSERT(*pte == entry);
+    upage_map(pte, newpa, true);
+    tlb_load(va, newpa, writeable);
+    asid_drop_remote(as);
+    upage_unref(as, oldindex);
+  }
+  freed = upage_unref(NULL, oldindex);
+  coremap_unlock();
+
+  if (freed) {
+    page_free(oldpa);
+  }
+  if (newpa == 0) {
+    return ENOMEM;
+  }
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_cowcopies++;
+  spinlock_release(&vmstats_lock);
+  vm_chargefault(false);
+  return 0;
+}
+
+/*
+* Demand paging. Every page of a region, the heap or the stack is backed on
+* first touch by a zero-filled frame and may later be evicted to swap;
+* otherwise misses are refilled from the page table, which is indexed
+* directly by the VPN. The TLB is loaded with the coremap lock held so a
+* concurrent eviction cannot slip in between reading the PTE and loading it.
+* Every load marks the frame referenced, and clean frames are loaded
+* read-only so the first write to them can mark them dirty.
+**/
+int
+vm_fault(int faulttype, vaddr_t faultaddress) {
+  struct addrspace *as;
+  pte_t *pte;
+  pte_t entry;
+  bool writeable;
+  int result, index;
+
+  faultaddress &= PAGE_FRAME;
+
+  if (curproc == NULL) {
+    /*
+     * No process. This is probably a kernel fault early
+     * in boot. Return EFAULT so as to panic instead of
+     * getting into an infinite faulting loop.
+     */
+    return EFAULT;
+  }
+  as = proc_getas();
+  if (as == NULL) {
+    /* Kernel thread touching user addresses; no address space to fault in */
+    return EFAULT;
+  }
+
+  result = as_find_region(as, faultaddress, &writeable);
+  if (result) {
+    return result;
+  }
+  switch (faulttype) {
+    case VM_FAULT_READONLY:
+      /* Clean and copy-on-write pages are loaded read-only */
+    case VM_FAULT_WRITE:
+      if (!writeable) {
+        return EFAULT;
+      }
+      break;
+    case VM_FAULT_READ:
+      break;
+    default:
+      return EINVAL;
+  }
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_faults++;
+  spinlock_release(&vmstats_lock);
+  if (faulttype != VM_FAULT_READONLY) {
+    curproc->p_vmstats.pv_tlbmisses++;
+  }
+
+  pte = pgdir_lookup(as->pgdir, faultaddress, true);
+  if (pte == NULL) {
+    return ENOMEM;
+  }
+
+  coremap_lock();
+  entry = *pte;
+  if ((entry & PTE_VALID) == 0) {
+    coremap_unlock();
+    return vm_pagein(as, faultaddress, pte, entry,
+                     faulttype != VM_FAULT_READ, writeable);
+  }
+  index = PADDR_TO_CMINDEX(entry & PTE_FRAME);
+  coremap[index].referenced = true;
+  if (faulttype == VM_FAULT_READ) {
+    tlb_load(faultaddress, entry & PTE_FRAME,
+             writeable && coremap[index].dirty && (entry & PTE_COW) == 0);
+    tlb_prefetch(as, faultaddress, pte);
+    coremap_unlock();
+    return 0;
+  }
+  if ((entry & PTE_COW) == 0) {
+    /* First write to a clean page, or a miss on a dirty one */
+    coremap[index].dirty = true;
+    tlb_load(faultaddress, entry & PTE_FRAME, true);
+    tlb_prefetch(as, faultaddress, pte);
+    coremap_unlock();
+
+    spinlock_acquire(&vmstats_lock);
+    vmstats.vfs_dirtyfaults++;
+    spinlock_release(&vmstats_lock);
+    return 0;
+  }
+
+  spinlock_acquire(&vmstats_lock);
+  vmstats.vfs_cowfaults++;
+  spinlock_release(&vmstats_lock);
+
+  /* If no one else maps the frame any more we simply take it over */
+  if (coremap[index].refCount == 1) {
+    coremap[index].as    = as;
+    coremap[index].va    = faultaddress;
+    coremap[index].dirty = true;
+    *pte = entry & ~PTE_COW;
+    tlb_load(faultaddress, entry & PTE_FRAME, writeable);
+    coremap_unlock();
+    return 0;
+  }
+  coremap[index].refCount++;
+  coremap_unlock();
+
+  return vm_cow_copy(as, faultaddress, pte, entry, writeable);
+}
+
+void
+vm_getfaultstats(struct vm_faultstats *stats) {
+  struct cpu *c;
+  unsigned i;
+
+  spinlock_acquire(&vmstats_lock);
+  *stats = vmstats;
+  spinlock_release(&vmstats_lock);
+
+  for (i = 0; i < num_cpus; i++) {
+    c = cpu_getnum(i);
+    stats->vfs_tlbrefills += c->c_tlb_refills;
+    stats->vfs_tlbflushes += c->c_tlb_flushes;
+    stats->vfs_tlbprefetches += c->c_tlb_prefetches;
+    stats->vfs_tlbfastrefills += tlbrefill[c->c_number].tr_fast;
+  }
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	//panic("dumbvm tried to do tlb shootdown?!\n");
+  int i;
+    for (i=0; i<NUM_TLB; i++) {
+  		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+  }
+  tlb_setpid(curcpu->c_asid_cur);
+}
+
+/*
+* IPI handler for tlb_shootdown_send().
+**/
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+  tlb_invalidate(ts->ts_vaddr, ts->ts_asid);
+}
+
+/*Shoot down the TLB entry of the current address space for a given
+virtual address. The TLB is per-cpu, so a single probe with interrupts off
+is enough; no allocator lock is needed*/
+void
+tlb_shootdown_page_table_entry(vaddr_t va) {
+  KASSERT((va & PAGE_FRAME ) == va); //assert that va is a valid virtual address
+  tlb_invalidate(va, curcpu->c_asid_cur);
+}
+
+unsigned
+coremap_free_pages(void) {
+  unsigned nfree;
+
+  coremap_lock();
+  nfree = frames_free();
+  coremap_unlock();
+  return nfree;
+}
+
+unsigned
+coremap_total_pages(void) {
+  return coremap_page_num;
+}
+
+unsigned
+coremap_peak_bytes(void) {
+  unsigned peak;
+
+  coremap_lock();
+  peak = coremap_peak_size;
+  coremap_unlock();
+  return peak;
+}
+
+void
+coremap_reset_peak(void) {
+  coremap_lock();
+  coremap_peak_size = coremap_used_size - coremap_parked_bytes();
+  coremap_unlock();
+}
+
+/*
+* Pages that could still be handed to user programs: free frames plus free
+* swap slots. Used to refuse address space growth that could never be
+* backed, since pages are only allocated on first touch.
+**/
+unsigned
+vm_avail_pages(void) {
+  unsigned nslots, nused;
+
+  if (!swap_enabled()) {
+    return coremap_free_pages();
+  }
+  swap_getstats(&nslots, &nused);
+  return coremap_free_pages() + (nslots - nused);
+}
+
+unsigned
+int coremap_used_bytes(void) {
+  unsigned used;
+
+  coremap_lock();
+  used = coremap_used_size - coremap_parked_bytes();
+  coremap_unlock();
+  return used;
 }
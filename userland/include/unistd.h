@@ -40,7 +40,10 @@
  */
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
+#include <kern/iovec.h>
+#include <kern/mman.h>
 #include <kern/reboot.h>
+#include <kern/resource.h>
 #include <kern/seek.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
@@ -132,6 +135,13 @@ pid_t getpid(void);
 int ioctl(int filehandle, int code, void *buf);
 off_t lseek(int filehandle, off_t pos, int code);
 int fsync(int filehandle);
+ssize_t pread(int filehandle, void *buf, size_t size, off_t pos);
+ssize_t pwrite(int filehandle, const void *buf, size_t size, off_t pos);
+ssize_t readv(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t writev(int filehandle, const struct iovec *iov, int iovcnt);
+ssize_t preadv(int filehandle, const struct iovec *iov, int iovcnt, off_t pos);
+ssize_t pwritev(int filehandle, const struct iovec *iov, int iovcnt,
+		off_t pos);
 int ftruncate(int filehandle, off_t size);
 int remove(const char *filename);
 int rename(const char *oldfile, const char *newfile);
@@ -147,6 +157,11 @@ ssize_t readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 int __time(time_t *seconds, unsigned long *nanoseconds);
+void *mmap(void *addr, size_t len, int prot, int flags, int filehandle,
+	   off_t offset);
+int munmap(void *addr, size_t len);
+int mprotect(void *addr, size_t len, int prot);
+int getrusage(int who, struct rusage *usage);
 ssize_t __getcwd(char *buf, size_t buflen);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
@@ -159,4 +174,7 @@ int execvp(const char *prog, char *const *args); /* calls execv */
 char *getcwd(char *buf, size_t buflen);		/* calls __getcwd */
 time_t time(time_t *seconds);			/* calls __time */
 
+/* Returned by mmap() on error */
+#define MAP_FAILED ((void *)-1)
+
 #endif /* _UNISTD_H_ */
@@ -496,6 +496,38 @@ __malloc_deadbeef(void *ptr, size_t size)
 	}
 }
 
+/*
+ * Free blocks at the top of the heap at least this big are given back
+ * to the kernel rather than kept on the free list.
+ */
+#define MTRIMSIZE (16 * PAGE_SIZE)
+
+/*
+ * Shrink the free block mh at the top of the heap to end at the first
+ * page boundary past its header and hand the pages above back with
+ * sbrk. This is the fast path for large blocks: their pages need not
+ * be wiped (which would fault them all back in just to throw them
+ * away), and a later large malloc gets fresh zero-filled pages from
+ * the kernel only as they are touched.
+ */
+static
+void
+__malloc_trim(struct mheader *mh)
+{
+	uintptr_t newtop;
+
+	newtop = (uintptr_t)M_DATA(mh) + MBLOCKSIZE;
+	newtop = PAGE_SIZE * ((newtop + PAGE_SIZE - 1) / PAGE_SIZE);
+	if (newtop >= __heaptop) {
+		return;
+	}
+	if (sbrk(-(intptr_t)(__heaptop - newtop)) == (void *)-1) {
+		return;
+	}
+	__heaptop = newtop;
+	mh->mh_nextblock = M_MKFIELD(newtop - (uintptr_t)mh);
+}
+
 /*
  * Attempt to merge two adjacent blocks (mh below mhnext).
  */
@@ -569,6 +601,12 @@ free(void *x)
 	/* mark it free */
 	mh->mh_inuse = 0;
 
+	/* If it's a large block at the top, give most of it back */
+	if (M_NEXT(mh) == (struct mheader *)__heaptop &&
+	    M_SIZE(mh) >= MTRIMSIZE) {
+		__malloc_trim(mh);
+	}
+
 	/* wipe it */
 	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
 
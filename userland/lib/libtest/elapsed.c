@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * elapsed.c
+ *
+ * 	Time since a given __time() reading.
+ */
+
+#include <unistd.h>
+#include <test/elapsed.h>
+
+/*
+ * Milliseconds since the given time.
+ */
+unsigned long
+msecs_since(time_t secs, unsigned long nsecs)
+{
+	time_t nowsecs;
+	unsigned long nownsecs;
+
+	__time(&nowsecs, &nownsecs);
+	return (unsigned long)(nowsecs - secs) * 1000 +
+		((long)nownsecs - (long)nsecs) / 1000000;
+}
+
+/*
+ * Microseconds since the given time.
+ */
+unsigned long
+usecs_since(time_t secs, unsigned long nsecs)
+{
+	time_t nowsecs;
+	unsigned long nownsecs;
+
+	__time(&nowsecs, &nownsecs);
+	return (unsigned long)(nowsecs - secs) * 1000000 +
+		((long)nownsecs - (long)nsecs) / 1000;
+}
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+
+/*
+ * fdbench - open/close and fork costs with many files open.
+ *
+ * Usage: fdbench [file]
+ *
+ * With 0, 16, 64 and 120 extra descriptors open on the same file, times
+ * open/close pairs (which look for the lowest free descriptor) and
+ * fork/exit/waitpid cycles (which copy the descriptor table). It also
+ * checks that a forked child shares its parent's open file, offset and
+ * all.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <sys/wait.h>
+#include <test161/test161.h>
+#include <test/elapsed.h>
+
+#define OPENROUNDS 2048
+#define FORKROUNDS 64
+#define MAXHELD 120
+
+static int held[MAXHELD];
+
+static
+void
+waitchild(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "child failed");
+	}
+}
+
+/*
+ * A write by the child has to move the parent's offset too.
+ */
+static
+void
+sharedoffset(const char *name)
+{
+	pid_t pid;
+	off_t pos;
+	int fd;
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", name);
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		if (write(fd, "0123456789", 10) != 10) {
+			_exit(1);
+		}
+		_exit(0);
+	}
+	waitchild(pid);
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != 10) {
+		errx(1, "offset after the child's write is %ld, not 10",
+		     (long)pos);
+	}
+	close(fd);
+	tprintf("Open file shared with forked child: ok\n");
+}
+
+static
+void
+run(const char *name, unsigned nheld)
+{
+	time_t secs;
+	unsigned long nsecs, us;
+	unsigned i;
+	pid_t pid;
+	int fd;
+
+	for (i = 0; i < nheld; i++) {
+		held[i] = open(name, O_RDONLY);
+		if (held[i] < 0) {
+			err(1, "%s: open %u", name, i);
+		}
+	}
+
+	__time(&secs, &nsecs);
+	for (i = 0; i < OPENROUNDS; i++) {
+		fd = open(name, O_RDONLY);
+		if (fd < 0) {
+			err(1, "%s: open", name);
+		}
+		close(fd);
+	}
+	us = usecs_since(secs, nsecs);
+	tprintf("  %3u open: %5lu us per open/close,", nheld,
+		us / OPENROUNDS);
+
+	__time(&secs, &nsecs);
+	for (i = 0; i < FORKROUNDS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			_exit(0);
+		}
+		waitchild(pid);
+	}
+	us = usecs_since(secs, nsecs);
+	tprintf(" %6lu us per fork/exit/wait\n", us / FORKROUNDS);
+
+	for (i = 0; i < nheld; i++) {
+		close(held[i]);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = "fdbench.dat";
+
+	if (argc > 1) {
+		name = argv[1];
+	}
+
+	sharedoffset(name);
+	tprintf("Descriptors held besides stdin/out/err:\n");
+	run(name, 0);
+	run(name, 16);
+	run(name, 64);
+	run(name, MAXHELD);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/fdbench");
+	return 0;
+}
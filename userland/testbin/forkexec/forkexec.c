@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * forkexec - fork+exec latency benchmark.
+ *
+ * Usage: forkexec [iterations] [kilobytes]
+ *
+ * Touches KILOBYTES of data so the parent has a real resident set, then
+ * runs fork, execv("/bin/true") in the child and waitpid in the parent
+ * ITERATIONS times, and reports the average latency. Since the child
+ * throws its address space away immediately, this shows what eager
+ * copying in fork costs; compare with the kernel menu's "cow off".
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <sys/wait.h>
+#include <test/elapsed.h>
+
+#define DEFAULT_ITERATIONS	50
+#define DEFAULT_KBYTES		512
+#define MAX_KBYTES		2048
+
+static char workset[MAX_KBYTES * 1024];
+
+int
+main(int argc, char *argv[])
+{
+	unsigned iterations, kbytes, i;
+	time_t startsecs;
+	unsigned long startnsecs, usecs;
+	char *args[2];
+	pid_t pid;
+	int status;
+
+	iterations = argc > 1 ? (unsigned)atoi(argv[1]) : DEFAULT_ITERATIONS;
+	kbytes = argc > 2 ? (unsigned)atoi(argv[2]) : DEFAULT_KBYTES;
+	if (iterations == 0 || kbytes > MAX_KBYTES) {
+		errx(1, "Usage: forkexec [iterations] [kilobytes <= %d]",
+		     MAX_KBYTES);
+	}
+
+	/* One write per page is enough to make it resident and dirty. */
+	for (i = 0; i < kbytes * 1024; i += 4096) {
+		workset[i] = (char)i;
+	}
+
+	args[0] = (char *)"true";
+	args[1] = NULL;
+
+	__time(&startsecs, &startnsecs);
+	for (i = 0; i < iterations; i++) {
+		pid = fork();
+		if (pid < 0) {
+			err(1, "fork");
+		}
+		if (pid == 0) {
+			execv("/bin/true", args);
+			_exit(1);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "child %d failed", pid);
+		}
+	}
+	usecs = usecs_since(startsecs, startnsecs);
+
+	printf("forkexec: %u fork+exec+wait with %uK resident: "
+	       "%lu usec total, %lu usec each\n",
+	       iterations, kbytes, usecs, usecs / iterations);
+	return 0;
+}
@@ -48,6 +48,7 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <err.h>
+#include <test/elapsed.h>
 
 
 #define _PATH_RANDOM   "random:"
@@ -629,6 +630,60 @@ test7(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * Test 8
+ *
+ * Times malloc/free of blocks of increasing size, touching every page
+ * of each block once. Large blocks live at the top of the heap, so
+ * freeing them hands their pages back with sbrk and the next malloc
+ * grows the heap again; this reports how fast that cycle runs.
+ */
+
+static
+void
+test8(void)
+{
+	static const size_t sizes[] = { SMALLSIZE, BIGSIZE, 256 * 1024,
+					1024 * 1024, 4 * 1024 * 1024 };
+	time_t secs;
+	unsigned long nsecs, ms, rounds, i;
+	size_t size, j;
+	unsigned k;
+	char *x;
+
+	tprintf("Beginning malloc test 8\n");
+
+	for (k=0; k<sizeof(sizes)/sizeof(sizes[0]); k++) {
+		size = sizes[k];
+		rounds = (16 * 1024 * 1024) / (size < 4096 ? 4096 : size);
+		__time(&secs, &nsecs);
+		for (i=0; i<rounds; i++) {
+			x = malloc(size);
+			if (x == NULL) {
+				tprintf("FAILED: malloc(%lu) failed\n",
+					(unsigned long) size);
+				return;
+			}
+			for (j=0; j<size; j+=4096) {
+				x[j] = (char)i;
+			}
+			free(x);
+		}
+		ms = msecs_since(secs, nsecs);
+		if (ms == 0) {
+			ms = 1;
+		}
+		tprintf("  %8lu bytes: %5lu rounds in %5lu ms, "
+			"%6lu allocs/sec, %8lu KB/sec\n",
+			(unsigned long) size, rounds, ms, rounds * 1000 / ms,
+			(unsigned long)((unsigned long long)size * rounds /
+					1024 * 1000 / ms));
+	}
+	tprintf("Passed malloc test 8\n");
+}
+
+////////////////////////////////////////////////////////////
+
 static struct {
 	int num;
 	const char *desc;
@@ -641,6 +696,7 @@ static struct {
 	{ 5, "Stress test", test5 },
 	{ 6, "Randomized stress test", test6 },
 	{ 7, "Stress test with particular seed", test7 },
+	{ 8, "Allocation throughput", test8 },
 	{ -1, NULL, NULL }
 };
 
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * mmapbench - scan a file with read() and through mmap() and compare.
+ *
+ * Usage: mmapbench [file [kbytes]]
+ *
+ * Writes a file of the given size (default 1024K), then sums its bytes
+ * three ways: a read() loop through a user buffer, a private read-only
+ * mapping, and a second pass over the mapping once it is resident. After
+ * that it checks that stores through a shared mapping reach the file and
+ * that a shared anonymous mapping is seen by a forked child. Last, it
+ * times TLB misses on the same pages split into more and more mappings,
+ * which is what the fault handler's region lookup costs. It ends with
+ * what getrusage() says all that cost in faults and resident pages.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include <err.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <test161/test161.h>
+#include <test/elapsed.h>
+
+#define BUFSIZE 4096
+#define LOOKUPPAGES 256		/* well past the 64 TLB entries */
+#define LOOKUPROUNDS 128
+
+static char buf[BUFSIZE];
+
+static
+void
+report(const char *what, unsigned long ms, size_t size, unsigned sum)
+{
+	if (ms == 0) {
+		ms = 1;
+	}
+	tprintf("  %-22s %6lu ms, %6lu KB/sec (sum %u)\n", what, ms,
+		(unsigned long)(size / 1024) * 1000 / ms, sum);
+}
+
+static
+void
+makefile(const char *name, size_t size)
+{
+	size_t done, i;
+	ssize_t r;
+	int fd;
+
+	fd = open(name, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: create", name);
+	}
+	for (done = 0; done < size; done += BUFSIZE) {
+		for (i = 0; i < BUFSIZE; i++) {
+			buf[i] = (char)((done + i) * 7 + 3);
+		}
+		r = write(fd, buf, BUFSIZE);
+		if (r != BUFSIZE) {
+			err(1, "%s: write", name);
+		}
+	}
+	close(fd);
+}
+
+static
+unsigned
+readsum(const char *name, size_t size)
+{
+	unsigned sum = 0;
+	size_t done;
+	ssize_t r, i;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	for (done = 0; done < size; done += r) {
+		r = read(fd, buf, BUFSIZE);
+		if (r <= 0) {
+			err(1, "%s: read", name);
+		}
+		for (i = 0; i < r; i++) {
+			sum += (unsigned char)buf[i];
+		}
+	}
+	close(fd);
+	return sum;
+}
+
+static
+unsigned
+mapsum(const unsigned char *p, size_t size)
+{
+	unsigned sum = 0;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		sum += p[i];
+	}
+	return sum;
+}
+
+static
+void
+scan(const char *name, size_t size)
+{
+	unsigned char *p;
+	unsigned sum1, sum2, sum3;
+	time_t secs;
+	unsigned long nsecs, ms;
+	int fd;
+
+	tprintf("Scanning %lu KB:\n", (unsigned long)size / 1024);
+
+	__time(&secs, &nsecs);
+	sum1 = readsum(name, size);
+	ms = msecs_since(secs, nsecs);
+	report("read() loop", ms, size, sum1);
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	__time(&secs, &nsecs);
+	p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	sum2 = mapsum(p, size);
+	ms = msecs_since(secs, nsecs);
+	report("mmap, paging in", ms, size, sum2);
+
+	__time(&secs, &nsecs);
+	sum3 = mapsum(p, size);
+	ms = msecs_since(secs, nsecs);
+	report("mmap, resident", ms, size, sum3);
+
+	if (munmap(p, size)) {
+		err(1, "munmap");
+	}
+	close(fd);
+
+	if (sum1 != sum2 || sum1 != sum3) {
+		errx(1, "FAILED: sums differ");
+	}
+}
+
+static
+void
+sharedfile(const char *name, size_t size)
+{
+	unsigned char *p;
+	unsigned sum, expect;
+	size_t i;
+	int fd;
+
+	tprintf("Storing through a shared mapping...\n");
+	expect = readsum(name, size) + size;
+
+	fd = open(name, O_RDWR);
+	if (fd < 0) {
+		err(1, "%s: open", name);
+	}
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	/* Add one to every byte that will not wrap around */
+	for (i = 0; i < size; i++) {
+		if (p[i] == 255) {
+			expect -= 256;
+		}
+		p[i]++;
+	}
+	if (fsync(fd)) {
+		err(1, "fsync");
+	}
+	sum = readsum(name, size);
+	if (sum != expect) {
+		errx(1, "FAILED: file sum %u after fsync, expected %u",
+		     sum, expect);
+	}
+	if (munmap(p, size)) {
+		err(1, "munmap");
+	}
+	close(fd);
+	tprintf("  stores reached the file\n");
+}
+
+static
+void
+sharedanon(void)
+{
+	volatile int *p;
+	pid_t pid;
+	int status;
+
+	tprintf("Sharing anonymous memory with a child...\n");
+	p = mmap(NULL, BUFSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON,
+		 -1, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	*p = 1;
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		*p = 2;
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (*p != 2) {
+		errx(1, "FAILED: parent sees %d, child stored 2", *p);
+	}
+	munmap((void *)p, BUFSIZE);
+	tprintf("  child's store seen by the parent\n");
+}
+
+static
+void
+regionlookup(void)
+{
+	static char *maps[LOOKUPPAGES];
+	volatile char *p;
+	unsigned nmaps, per, i, j, round;
+	unsigned long ms, naccesses;
+	time_t secs;
+	unsigned long nsecs;
+
+	tprintf("TLB misses over %u pages:\n", LOOKUPPAGES);
+	for (nmaps = 1; nmaps <= LOOKUPPAGES; nmaps *= 4) {
+		per = LOOKUPPAGES / nmaps;
+		for (i = 0; i < nmaps; i++) {
+			maps[i] = mmap(NULL, per * BUFSIZE, PROT_READ|PROT_WRITE,
+				       MAP_PRIVATE|MAP_ANON, -1, 0);
+			if (maps[i] == MAP_FAILED) {
+				err(1, "mmap");
+			}
+			/* Fault everything in now so only TLB misses are timed */
+			for (j = 0; j < per; j++) {
+				maps[i][j * BUFSIZE] = 1;
+			}
+		}
+
+		__time(&secs, &nsecs);
+		for (round = 0; round < LOOKUPROUNDS; round++) {
+			for (i = 0; i < nmaps; i++) {
+				for (j = 0; j < per; j++) {
+					p = maps[i] + j * BUFSIZE;
+					(void)*p;
+				}
+			}
+		}
+		ms = msecs_since(secs, nsecs);
+
+		naccesses = (unsigned long)LOOKUPPAGES * LOOKUPROUNDS;
+		tprintf("  %4u regions %6lu ms, %5lu ns per access\n", nmaps, ms,
+			ms * 1000 / (naccesses / 1000));
+
+		for (i = 0; i < nmaps; i++) {
+			if (munmap(maps[i], per * BUFSIZE)) {
+				err(1, "munmap");
+			}
+		}
+	}
+}
+
+static
+void
+printusage(const char *who, int which)
+{
+	struct rusage ru;
+
+	if (getrusage(which, &ru)) {
+		err(1, "getrusage");
+	}
+	tprintf("%s: %u KB resident (max %u KB), %u minor and %u major "
+		"faults, %u swapped in, %u swapped out, %u TLB misses\n",
+		who, (unsigned)ru.ru_rss, (unsigned)ru.ru_maxrss,
+		(unsigned)ru.ru_minflt, (unsigned)ru.ru_majflt,
+		(unsigned)ru.ru_nswapin, (unsigned)ru.ru_nswapout,
+		(unsigned)ru.ru_ntlbmiss);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = "mmapbench.dat";
+	size_t size = 1024 * 1024;
+
+	if (argc > 1) {
+		name = argv[1];
+	}
+	if (argc > 2) {
+		size = (size_t)atoi(argv[2]) * 1024;
+	}
+	if (size == 0 || size % BUFSIZE != 0) {
+		errx(1, "Usage: mmapbench [file [kbytes]] (kbytes a multiple of 4)");
+	}
+
+	makefile(name, size);
+	scan(name, size);
+	sharedfile(name, size);
+	sharedanon();
+	regionlookup();
+	printusage("self", RUSAGE_SELF);
+	printusage("children", RUSAGE_CHILDREN);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/mmapbench");
+	return 0;
+}
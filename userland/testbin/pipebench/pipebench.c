@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * pipebench - stream data from parent to child through a pipe.
+ *
+ * Usage: pipebench
+ *
+ * For a range of chunk sizes, the parent writes TOTAL bytes into a
+ * pipe in chunks of that size and a forked child reads them back with
+ * the same size, checking the byte pattern, until end of file. Prints
+ * the throughput for each size. Also checks that a write with the read
+ * end closed fails with EPIPE.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <err.h>
+#include <sys/wait.h>
+#include <test161/test161.h>
+#include <test/elapsed.h>
+
+#define TOTAL (1024*1024)
+#define MAXCHUNK 16384
+
+static unsigned char buf[MAXCHUNK];
+
+/*
+ * Byte number POS of the stream.
+ */
+static
+unsigned char
+pattern(unsigned pos)
+{
+	return (pos * 7 + (pos >> 11)) & 0xff;
+}
+
+/*
+ * Child: read until EOF; the exit status says whether all of it came
+ * through intact.
+ */
+static
+void
+consume(int fd, size_t chunk)
+{
+	unsigned pos = 0;
+	ssize_t len, i;
+
+	while ((len = read(fd, buf, chunk)) > 0) {
+		for (i = 0; i < len; i++) {
+			if (buf[i] != pattern(pos + i)) {
+				_exit(2);
+			}
+		}
+		pos += len;
+	}
+	_exit(len < 0 || pos != TOTAL ? 1 : 0);
+}
+
+static
+void
+run(size_t chunk)
+{
+	time_t secs;
+	unsigned long nsecs, us;
+	unsigned pos, i;
+	int fds[2], status;
+	pid_t pid;
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	__time(&secs, &nsecs);
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		close(fds[1]);
+		consume(fds[0], chunk);
+	}
+	close(fds[0]);
+
+	for (pos = 0; pos < TOTAL; pos += chunk) {
+		for (i = 0; i < chunk; i++) {
+			buf[i] = pattern(pos + i);
+		}
+		if (write(fds[1], buf, chunk) != (ssize_t)chunk) {
+			err(1, "write");
+		}
+	}
+	close(fds[1]);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	us = usecs_since(secs, nsecs);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "chunk %u: reader got bad data (status %d)",
+		     (unsigned)chunk, status);
+	}
+	tprintf("%6u %12lu\n", (unsigned)chunk,
+		(TOTAL / 1024) * 1000UL / (us / 1000 + 1));
+}
+
+static
+void
+brokenpipe(void)
+{
+	int fds[2];
+
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+	close(fds[0]);
+	if (write(fds[1], "x", 1) != -1 || errno != EPIPE) {
+		errx(1, "write with no reader did not fail with EPIPE");
+	}
+	close(fds[1]);
+	tprintf("Write with the read end closed: EPIPE, ok\n");
+}
+
+int
+main(void)
+{
+	size_t chunk;
+
+	brokenpipe();
+	tprintf(" chunk         KB/s\n");
+	for (chunk = 16; chunk <= MAXCHUNK; chunk *= 4) {
+		run(chunk);
+	}
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/pipebench");
+	return 0;
+}
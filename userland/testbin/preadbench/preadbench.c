@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * preadbench - concurrent reads of one shared open file.
+ *
+ * Usage: preadbench [file]
+ *
+ * Writes the file with pwrite, checks it back with pread and that
+ * neither moved the file offset. Then 1, 2 and 4 forked children,
+ * all using the descriptor inherited from the parent, split the same
+ * amount of reading between them: first with read(), which goes
+ * through the shared offset and its lock, then with pread() over a
+ * disjoint range each. On a multiprocessor the pread rate should grow with the number of
+ * children, as far as the file system underneath lets it.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <sys/wait.h>
+#include <test161/test161.h>
+#include <test/elapsed.h>
+
+#define BLOCKSIZE 512
+#define NBLOCKS 256		/* 128k file */
+#define ROUNDS 8		/* passes over each child's share */
+#define MAXCHILDREN 4
+
+static char buf[BLOCKSIZE];
+
+static
+void
+fillblock(unsigned block)
+{
+	memset(buf, 'a' + block % 26, BLOCKSIZE);
+}
+
+static
+void
+makefile(int fd)
+{
+	unsigned i;
+	off_t pos;
+
+	/* write back to front, so nothing leans on the offset */
+	for (i = NBLOCKS; i-- > 0; ) {
+		fillblock(i);
+		if (pwrite(fd, buf, BLOCKSIZE,
+			   (off_t)i * BLOCKSIZE) != BLOCKSIZE) {
+			err(1, "pwrite block %u", i);
+		}
+	}
+	for (i = 0; i < NBLOCKS; i++) {
+		if (pread(fd, buf, BLOCKSIZE,
+			  (off_t)i * BLOCKSIZE) != BLOCKSIZE) {
+			err(1, "pread block %u", i);
+		}
+		if (buf[0] != 'a' + (int)(i % 26) ||
+		    buf[BLOCKSIZE-1] != buf[0]) {
+			errx(1, "block %u reads back wrong", i);
+		}
+	}
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos != 0) {
+		errx(1, "pread/pwrite moved the offset to %ld", (long)pos);
+	}
+	tprintf("pwrite/pread round trip, offset untouched: ok\n");
+}
+
+/*
+ * Child body: read ROUNDS times as much as one child's share of the
+ * file, either through the shared offset or positionally.
+ */
+static
+void
+reader(int fd, unsigned child, unsigned nchildren, int positional)
+{
+	unsigned share = NBLOCKS / nchildren;
+	unsigned first = child * share;
+	unsigned r, i;
+	ssize_t len;
+
+	for (r = 0; r < ROUNDS; r++) {
+		for (i = 0; i < share; i++) {
+			if (positional) {
+				len = pread(fd, buf, BLOCKSIZE,
+					    (off_t)(first + i) * BLOCKSIZE);
+			}
+			else {
+				len = read(fd, buf, BLOCKSIZE);
+				if (len == 0) {
+					lseek(fd, 0, SEEK_SET);
+					continue;
+				}
+			}
+			if (len < 0) {
+				_exit(1);
+			}
+		}
+	}
+	_exit(0);
+}
+
+static
+unsigned long
+run(int fd, unsigned nchildren, int positional)
+{
+	pid_t pids[MAXCHILDREN];
+	time_t secs;
+	unsigned long nsecs;
+	unsigned i;
+	int status, failed = 0;
+
+	lseek(fd, 0, SEEK_SET);
+	__time(&secs, &nsecs);
+	for (i = 0; i < nchildren; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			reader(fd, i, nchildren, positional);
+		}
+	}
+	for (i = 0; i < nchildren; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			failed = 1;
+		}
+	}
+	if (failed) {
+		errx(1, "a reader failed");
+	}
+	return usecs_since(secs, nsecs);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = "preadbench.dat";
+	unsigned long kb, us;
+	unsigned n;
+	int fd;
+
+	if (argc > 1) {
+		name = argv[1];
+	}
+
+	fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	makefile(fd);
+
+	kb = (unsigned long)NBLOCKS * BLOCKSIZE / 1024 * ROUNDS;
+	tprintf("children    read() KB/s   pread() KB/s\n");
+	for (n = 1; n <= MAXCHILDREN; n *= 2) {
+		tprintf("%8u", n);
+		us = run(fd, n, 0);
+		tprintf(" %13lu", kb * 1000 / (us / 1000 + 1));
+		us = run(fd, n, 1);
+		tprintf(" %14lu\n", kb * 1000 / (us / 1000 + 1));
+	}
+
+	close(fd);
+	remove(name);
+	success(TEST161_SUCCESS, SECRET, "/testbin/preadbench");
+	return 0;
+}
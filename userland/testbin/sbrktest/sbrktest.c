@@ -36,6 +36,7 @@
 #include <err.h>
 #include <errno.h>
 #include <test161/test161.h>
+#include <test/elapsed.h>
 
 #define _PATH_RANDOM   "random:"
 
@@ -1125,6 +1126,64 @@ test21(void)
 	stresstest(geti(), true);
 }
 
+////////////////////////////////////////////////////////////
+// throughput
+
+/*
+ * Grow the heap by npages pages, touch the first byte of every one of
+ * them if asked to, and shrink it back again; do this rounds times and
+ * report how many pages per second went through the heap.
+ */
+static
+void
+growshrink(unsigned npages, bool touch, unsigned rounds)
+{
+	time_t secs;
+	unsigned long nsecs, ms;
+	unsigned i, j;
+	char *p;
+
+	__time(&secs, &nsecs);
+	for (i=0; i<rounds; i++) {
+		p = dosbrk(npages * PAGE_SIZE);
+		if (touch) {
+			for (j=0; j<npages; j++) {
+				p[j * PAGE_SIZE] = (char)i;
+			}
+		}
+		(void)dosbrk(-(ssize_t)(npages * PAGE_SIZE));
+	}
+	ms = msecs_since(secs, nsecs);
+	if (ms == 0) {
+		ms = 1;
+	}
+	tprintf("  %5u pages %s: %5u rounds in %5lu ms, %8lu pages/sec\n",
+		npages, touch ? "touched  " : "untouched", rounds, ms,
+		(unsigned long)npages * rounds * 1000 / ms);
+}
+
+/*
+ * Heap growth is lazy, so untouched growth should cost the same no
+ * matter how big it is; touched growth costs one zero-fill fault per
+ * page, and shrinking has to give every touched page back.
+ */
+static
+void
+test22(void)
+{
+	static const unsigned sizes[] = { 1, 16, 256, 1024 };
+	unsigned i;
+
+	tprintf("Timing heap growth and shrinkage:\n");
+	for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+		growshrink(sizes[i], false, 1000);
+	}
+	for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+		growshrink(sizes[i], true, 4096 / sizes[i]);
+	}
+	tprintf("Passed sbrk test 22.\n");
+}
+
 ////////////////////////////////////////////////////////////
 // main
 
@@ -1154,6 +1213,7 @@ static const struct {
 	{ 19, "Large stress test", test19 },
 	{ 20, "Randomized large stress test", test20 },
 	{ 21, "Large stress test with particular seed", test21 },
+	{ 22, "Heap grow/shrink throughput", test22 },
 };
 static const unsigned numtests = sizeof(tests) / sizeof(tests[0]);
 
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * writevbench - log records written with writev versus two writes.
+ *
+ * Usage: writevbench [file]
+ *
+ * Each record is a small header followed by a payload. For several
+ * payload sizes, writes RECORDS records to a new file, once issuing a
+ * write() for the header and another for the payload and once with a
+ * single writev(). Then checks that the records read back right, with
+ * readv() straight into header and payload buffers, and that
+ * pwritev()/preadv() leave the file offset alone.
+ */
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test161/test161.h>
+#include <test/elapsed.h>
+
+#define RECORDS 1024
+#define MAXPAYLOAD 1024
+
+struct header {
+	unsigned magic;
+	unsigned seq;
+	unsigned len;
+	unsigned sum;
+};
+
+#define MAGIC 0x10cf11e5
+
+static char payload[MAXPAYLOAD];
+static char rpayload[MAXPAYLOAD];
+
+static
+void
+mkheader(struct header *h, unsigned seq, unsigned len)
+{
+	h->magic = MAGIC;
+	h->seq = seq;
+	h->len = len;
+	h->sum = seq * 31 + len;
+}
+
+static
+int
+create(const char *name)
+{
+	int fd;
+
+	fd = open(name, O_RDWR|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s", name);
+	}
+	return fd;
+}
+
+/*
+ * Write RECORDS records to a fresh file; returns microseconds taken.
+ */
+static
+unsigned long
+writelog(int fd, unsigned len, int vectored)
+{
+	struct header h;
+	struct iovec iov[2];
+	time_t secs;
+	unsigned long nsecs;
+	unsigned i;
+
+	iov[0].iov_base = &h;
+	iov[0].iov_len = sizeof(h);
+	iov[1].iov_base = payload;
+	iov[1].iov_len = len;
+
+	__time(&secs, &nsecs);
+	for (i = 0; i < RECORDS; i++) {
+		mkheader(&h, i, len);
+		if (vectored) {
+			if (writev(fd, iov, 2) != (ssize_t)(sizeof(h) + len)) {
+				err(1, "writev");
+			}
+		}
+		else {
+			if (write(fd, &h, sizeof(h)) != sizeof(h) ||
+			    write(fd, payload, len) != (ssize_t)len) {
+				err(1, "write");
+			}
+		}
+	}
+	return usecs_since(secs, nsecs);
+}
+
+static
+void
+checklog(int fd, unsigned len)
+{
+	struct header h, want;
+	struct iovec iov[2];
+	unsigned i;
+
+	iov[0].iov_base = &h;
+	iov[0].iov_len = sizeof(h);
+	iov[1].iov_base = rpayload;
+	iov[1].iov_len = len;
+
+	lseek(fd, 0, SEEK_SET);
+	for (i = 0; i < RECORDS; i++) {
+		if (readv(fd, iov, 2) != (ssize_t)(sizeof(h) + len)) {
+			err(1, "readv record %u", i);
+		}
+		mkheader(&want, i, len);
+		if (memcmp(&h, &want, sizeof(h)) != 0 ||
+		    memcmp(rpayload, payload, len) != 0) {
+			errx(1, "record %u reads back wrong", i);
+		}
+	}
+}
+
+/*
+ * Rewrite record 0 in place and read it back, positionally.
+ */
+static
+void
+checkpositional(int fd, unsigned len)
+{
+	struct header h, want;
+	struct iovec iov[2];
+	off_t end;
+
+	end = lseek(fd, 0, SEEK_END);
+	mkheader(&want, 0, len);
+	iov[0].iov_base = &want;
+	iov[0].iov_len = sizeof(want);
+	iov[1].iov_base = payload;
+	iov[1].iov_len = len;
+	if (pwritev(fd, iov, 2, 0) != (ssize_t)(sizeof(want) + len)) {
+		err(1, "pwritev");
+	}
+	iov[0].iov_base = &h;
+	iov[1].iov_base = rpayload;
+	if (preadv(fd, iov, 2, 0) != (ssize_t)(sizeof(h) + len)) {
+		err(1, "preadv");
+	}
+	if (memcmp(&h, &want, sizeof(h)) != 0 ||
+	    memcmp(rpayload, payload, len) != 0) {
+		errx(1, "preadv of record 0 reads back wrong");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != end) {
+		errx(1, "pwritev/preadv moved the offset");
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned sizes[] = { 16, 112, 496, MAXPAYLOAD };
+	const char *name = "writevbench.dat";
+	unsigned long us2, us1;
+	unsigned i;
+	int fd;
+
+	if (argc > 1) {
+		name = argv[1];
+	}
+	for (i = 0; i < MAXPAYLOAD; i++) {
+		payload[i] = 'A' + i % 53;
+	}
+
+	tprintf("payload   2x write() records/s   writev() records/s\n");
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		fd = create(name);
+		us2 = writelog(fd, sizes[i], 0);
+		checklog(fd, sizes[i]);
+		close(fd);
+
+		fd = create(name);
+		us1 = writelog(fd, sizes[i], 1);
+		checklog(fd, sizes[i]);
+		checkpositional(fd, sizes[i]);
+		close(fd);
+
+		tprintf("%7u %22lu %20lu\n", sizes[i],
+			RECORDS * 1000UL / (us2 / 1000 + 1),
+			RECORDS * 1000UL / (us1 / 1000 + 1));
+	}
+
+	remove(name);
+	success(TEST161_SUCCESS, SECRET, "/testbin/writevbench");
+	return 0;
+}
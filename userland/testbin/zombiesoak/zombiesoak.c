@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2014
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * zombiesoak - fork, exit and wait over and over.
+ *
+ * Usage: zombiesoak [cycles]
+ *
+ * Each cycle forks a child that dirties a few pages of its own and
+ * exits; the parent waits for it. Every other child first forks a
+ * grandchild of its own and exits without waiting, so the grandchild
+ * is orphaned whether it exits before or after its parent. Every
+ * process here has a real address space, descriptor table and current
+ * directory, all of which have to be freed at exit (or, for orphans,
+ * by the kernel).
+ *
+ * Run from the kernel menu with "zsoak", which checks that the memory
+ * in use comes back to where it was.
+ */
+
+#include <sys/types.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/wait.h>
+
+#define CYCLES 100000
+#define REPORT 10000
+#define DIRTY  (3 * 4096)
+#define FORKTRIES 1000
+
+static char scratch[DIRTY];
+
+/*
+ * Touch some pages so the address space has copies of its own to free.
+ */
+static
+void
+dirty(unsigned cycle)
+{
+	unsigned i;
+
+	for (i = 0; i < DIRTY; i += 1024) {
+		scratch[i] = cycle;
+	}
+}
+
+static
+void
+child(unsigned cycle)
+{
+	pid_t pid;
+
+	dirty(cycle);
+	if (cycle % 2) {
+		pid = fork();
+		if (pid == 0) {
+			dirty(cycle);
+			_exit(0);
+		}
+		/* if fork failed there is just no orphan this time */
+	}
+	_exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned cycles = CYCLES, i, tries;
+	int status;
+	pid_t pid;
+
+	if (argc > 1) {
+		cycles = atoi(argv[1]);
+	}
+
+	for (i = 0; i < cycles; i++) {
+		/* orphans the kernel has yet to free may fill the table */
+		pid = fork();
+		for (tries = 0; pid < 0 && tries < FORKTRIES; tries++) {
+			pid = fork();
+		}
+		if (pid < 0) {
+			err(1, "cycle %u: fork", i);
+		}
+		if (pid == 0) {
+			child(i);
+		}
+		if (waitpid(pid, &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			errx(1, "cycle %u: child failed", i);
+		}
+		if ((i + 1) % REPORT == 0) {
+			printf("zombiesoak: %u cycles\n", i + 1);
+		}
+	}
+	return 0;
+}